@@ -0,0 +1,126 @@
+#pragma once
+#include <Arduino.h>
+#include <ESPAsyncTCP.h>
+
+#define HTTP_MAX_CLIENTS 4
+#define HTTP_SLOT_BUFFER 640 // Longest header line or form body; reused for the unsent response
+#define HTTP_URI_SIZE 96
+#ifndef HTTP_MAX_ROUTES
+#define HTTP_MAX_ROUTES 12
+#endif
+#define HTTP_REQUEST_TIMEOUT 5000UL // Whole request must arrive within this
+#define HTTP_KEEPALIVE_TIMEOUT 10000UL // Idle persistent connection is closed after this
+#define HTTP_CHUNKED ((size_t)-1)   // beginResponse() length for chunked bodies
+#define HTTP_MAX_STREAMS 2 // Event-stream subscribers; the other slots stay for requests
+#define HTTP_STREAM_HEARTBEAT 15000UL // Comment line on a quiet stream; a stalled one is dropped
+
+enum HttpMethod : uint8_t { HTTP_ANY, HTTP_GET, HTTP_POST, HTTP_OTHER };
+
+/* =======================
+   One connection slot. lwIP callbacks only parse into the slot and move
+   queued bytes into the TCP window; the handler runs later from loop().
+   Headers are consumed line by line, so only the request line, the few
+   headers we use and the body are kept.
+   ======================= */
+class AsyncHttpRequest {
+ public:
+  HttpMethod method() const { return method_; }
+  const char* path() const { return uri_; } // Query string stripped
+  const char* ifNoneMatch() const { return etag_; }
+  const char* body() const { return buf_; } // Valid until a response begins
+  size_t bodyLength() const { return bodyLen_; }
+  bool arg(const char* name, char* out, size_t size) const; // URL-decoded; false when absent
+  bool hasArg(const char* name) const;
+
+  // Response. The request body is overwritten once a response begins, so
+  // read every argument first. `headers` is preformatted "Name: v\r\n" lines.
+  void beginResponse(int code, const char* type, size_t len, const char* headers = nullptr);
+  void write(const char* data, size_t len);
+  void end();
+  void send(int code, const char* type, const char* body, size_t len, const char* headers = nullptr);
+  void send(int code, const char* type, const char* body) { send(code, type, body, strlen(body)); }
+  void send_P(int code, const char* type, PGM_P body, size_t len, const char* headers = nullptr);
+  // Server-Sent Events, after AsyncHttpServer::subscribe(). `data` is one
+  // line. False (and the stream is closed) when the client is not keeping up.
+  bool event(const char* name, const char* data, size_t len);
+
+ private:
+  friend class AsyncHttpServer;
+  enum State : uint8_t { FREE, RECV_HEAD, RECV_BODY, READY, HANDLING, SENDING, STREAM };
+  void open(AsyncClient* client);
+  void reset();
+  AsyncClient* detach();
+  bool idle() const { return state_ == RECV_HEAD && !len_ && !uri_[0]; }
+  void feed(const char* data, size_t len);
+  void headerLine(char* line);
+  void fail(int code);
+  void queue(const char* data, size_t len);
+  void pump();
+  const char* findArg(const char* src, const char* name, size_t& len) const;
+  static void onData(void* arg, AsyncClient* c, void* data, size_t len);
+  static void onAck(void* arg, AsyncClient* c, size_t len, uint32_t time);
+  static void onDisconnect(void* arg, AsyncClient* c);
+
+  AsyncClient* client_ = nullptr;
+  State state_ = FREE;
+  HttpMethod method_ = HTTP_OTHER;
+  bool chunked_ = false;
+  bool started_ = false;    // beginResponse() called
+  bool done_ = false;       // end() called; close once everything is queued
+  bool keepAlive_ = false;  // HTTP/1.1 without "Connection: close"
+  uint16_t served_ = 0;     // Responses on this connection
+  uint16_t error_ = 0;      // Reply sent by poll() instead of a handler
+  uint16_t len_ = 0;        // Bytes held in buf_
+  uint16_t sent_ = 0;       // Of those, already handed to TCP
+  uint16_t bodyLen_ = 0;    // Content-Length
+  unsigned long since_ = 0; // Request (or idle wait) started
+  PGM_P tail_ = nullptr;    // Flash body streamed after buf_
+  size_t tailLen_ = 0;
+  char uri_[HTTP_URI_SIZE];
+  char query_[HTTP_URI_SIZE];
+  char etag_[40];
+  char buf_[HTTP_SLOT_BUFFER];
+};
+
+typedef void (*HttpHandler)(AsyncHttpRequest& req);
+
+/* =======================
+   Event-driven HTTP/1.1 server on ESPAsyncTCP: up to HTTP_MAX_CLIENTS
+   concurrent connections in fixed slots, no per-request heap. A slow or
+   stalled client only holds its own slot; loop() never waits on a socket.
+   Connections are persistent unless the client asks otherwise; an idle
+   one gives up its slot when a new client finds none free. Up to
+   HTTP_MAX_STREAMS slots can be held open as event streams that
+   broadcast() writes to, so subscribers see changes without polling.
+   ======================= */
+class AsyncHttpServer {
+ public:
+  explicit AsyncHttpServer(uint16_t port) : server_(port) {}
+  bool on(const char* path, HttpMethod method, HttpHandler fn); // False when HTTP_MAX_ROUTES are taken
+  void onNotFound(HttpHandler fn) { notFound_ = fn; }
+  void begin();
+  void poll(); // From loop(): run handlers for complete requests, expire slow ones
+  uint8_t active() const;
+  void setAccepting(bool on) { accepting_ = on; } // Off: new clients get 503, open ones are served
+  bool subscribe(AsyncHttpRequest& req); // From a handler; false when all stream slots are taken
+  uint8_t subscribers() const;
+  void broadcast(const char* name, const char* data, size_t len);
+  uint32_t rejected() const { return rejected_; }
+
+ private:
+  struct Route {
+    const char* path;
+    HttpMethod method;
+    HttpHandler fn;
+  };
+  static void onClient(void* arg, AsyncClient* c);
+  void reject(AsyncClient* c);
+  void dispatch(AsyncHttpRequest& req);
+  AsyncServer server_;
+  AsyncHttpRequest slots_[HTTP_MAX_CLIENTS];
+  Route routes_[HTTP_MAX_ROUTES];
+  uint8_t routeCount_ = 0;
+  HttpHandler notFound_ = nullptr;
+  uint32_t rejected_ = 0;
+  bool accepting_ = true;
+};
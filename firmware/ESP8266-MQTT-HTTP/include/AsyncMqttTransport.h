@@ -0,0 +1,42 @@
+#pragma once
+#include <Arduino.h>
+#include <Client.h>
+#include <ESPAsyncTCP.h>
+
+#define MQTT_RX_RING 1024 // Two full MQTT packets
+
+/* =======================
+   Non-blocking socket for PubSubClient. begin() only sends the SYN; the
+   caller polls connected()/failed() and hands the open socket to
+   mqtt.connect(), which then skips its own blocking dial. It still waits
+   for CONNACK, yielding to lwIP through available().
+   ======================= */
+class AsyncMqttTransport : public Client {
+ public:
+  AsyncMqttTransport();
+  bool begin(IPAddress ip, uint16_t port);
+  bool failed() const { return failed_; }
+
+  // PubSubClient only dials when the socket is down; never block for it.
+  int connect(IPAddress, uint16_t) override { return 0; }
+  int connect(const char*, uint16_t) override { return 0; }
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* buf, size_t size) override;
+  int available() override;
+  int read() override;
+  int read(uint8_t* buf, size_t size) override;
+  int peek() override;
+  void flush() override {}
+  void stop() override;
+  uint8_t connected() override { return client_.connected(); }
+  operator bool() override { return client_.connected(); }
+
+ private:
+  void onData(const uint8_t* data, size_t len);
+  AsyncClient client_;
+  // Filled from lwIP callbacks, drained from loop(); the ESP8266 never
+  // runs the two concurrently, so no locking is needed.
+  uint8_t rx_[MQTT_RX_RING];
+  size_t rxHead_ = 0, rxCount_ = 0;
+  bool failed_ = false;
+};
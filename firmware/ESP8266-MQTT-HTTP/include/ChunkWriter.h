@@ -0,0 +1,36 @@
+#pragma once
+#include <Arduino.h>
+
+#define CHUNK_BUFFER_SIZE 1400 // One TCP segment (MSS 1460) less chunk framing
+
+/* =======================
+   Renders a response into one caller-owned buffer and hands it to `flush`
+   only when full, so a page leaves in MSS-sized segments with no heap
+   allocation. Values are escaped straight into the buffer.
+   ======================= */
+class ChunkWriter {
+ public:
+  // `last` is true exactly once, from finish(); `first` when nothing has
+  // been flushed yet, so a response that fits can go out unchunked.
+  typedef void (*FlushFn)(const char* data, size_t len, bool first, bool last);
+
+  ChunkWriter(char* buf, size_t size, FlushFn flush) : buf_(buf), size_(size), flush_(flush) {}
+  ChunkWriter& write(const char* s, size_t n);
+  ChunkWriter& print(const char* s) { return write(s, strlen(s)); }
+  ChunkWriter& print(uint32_t v);
+  ChunkWriter& jsonString(const char* s); // Quoted and escaped
+  void finish();
+  size_t total() const { return total_ + len_; }
+
+ private:
+  void put(char c) {
+    if (len_ == size_) spill();
+    buf_[len_++] = c;
+  }
+  void spill();
+  char* buf_;
+  size_t size_;
+  FlushFn flush_;
+  size_t len_ = 0;
+  size_t total_ = 0;
+};
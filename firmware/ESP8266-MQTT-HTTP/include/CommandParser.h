@@ -0,0 +1,19 @@
+#pragma once
+#include <Arduino.h>
+
+enum CommandAction : uint8_t { CMD_NONE, CMD_UNKNOWN, CMD_ON, CMD_OFF, CMD_TOGGLE };
+enum ParseResult : uint8_t { PARSE_OK, PARSE_FALLBACK, PARSE_INVALID };
+
+struct RelayCommand {
+  CommandAction action; // "command"
+  int16_t channel;      // "channel", -1 when absent, 0 when present but not a channel number
+  uint32_t duration;    // "duration" in seconds, 0 when absent
+};
+
+/* =======================
+   Allocation-free parser for the flat command schema, run in place on the
+   PubSubClient buffer. Shapes it does not handle (nested values, escaped
+   strings) return PARSE_FALLBACK so the caller can use ArduinoJson.
+   ======================= */
+ParseResult parseCommand(const char* json, size_t len, RelayCommand& out);
+CommandAction commandAction(const char* value, size_t len);
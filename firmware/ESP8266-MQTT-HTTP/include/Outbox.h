@@ -0,0 +1,44 @@
+#pragma once
+#include <Arduino.h>
+
+#define OUTBOX_SLOTS 4
+#define OUTBOX_TOPIC_SIZE 80    // pub_t plus a suffix
+#define OUTBOX_PAYLOAD_SIZE 576 // Perf report, the largest message that can queue
+
+/* =======================
+   Outbound MQTT messages held while the session is down. A fixed ring of
+   slots, at most one per topic: a newer payload replaces the queued one
+   in place, so a topic keeps its position but only its latest value is
+   sent. When the ring is full the oldest message is dropped.
+   ======================= */
+class Outbox {
+ public:
+  typedef bool (*SendFn)(const char* topic, const char* payload, size_t len, bool retained);
+
+  bool put(const char* topic, const char* payload, size_t len, bool retained); // False if dropped
+  // Oldest first, up to `max` messages; stops at the first `send` that
+  // fails and keeps that message. True once empty.
+  bool drain(SendFn send, uint8_t max);
+  bool empty() const { return !count_; }
+  uint8_t depth() const { return count_; }
+  uint8_t peak() const { return peak_; }
+  uint32_t replaced() const { return replaced_; }
+  uint32_t dropped() const { return dropped_; }
+  uint32_t sent() const { return sent_; }
+
+ private:
+  struct Slot {
+    char topic[OUTBOX_TOPIC_SIZE];
+    char payload[OUTBOX_PAYLOAD_SIZE];
+    uint16_t len;
+    bool retained;
+  };
+  Slot& at(uint8_t i) { return slots_[(head_ + i) % OUTBOX_SLOTS]; }
+  Slot slots_[OUTBOX_SLOTS];
+  uint8_t head_ = 0;
+  uint8_t count_ = 0;
+  uint8_t peak_ = 0;
+  uint32_t replaced_ = 0;
+  uint32_t dropped_ = 0;
+  uint32_t sent_ = 0;
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include <Arduino.h>
+
+/* =======================
+   Retry timing for one link (station, broker session). Each retry waits
+   a random time in the upper half of a window that doubles per failure
+   up to a cap, so devices that lost the link together (broker restart,
+   AP reboot) spread out instead of reconnecting in lockstep, and a long
+   outage costs few attempts. up() resets the window and records how
+   long the link was down.
+   ======================= */
+class ReconnectPolicy {
+ public:
+  ReconnectPolicy(uint32_t base, uint32_t cap) : base_(base), cap_(cap) {}
+  uint32_t next(); // ms to wait before the next attempt; counts a retry
+  void down();     // Link lost; no-op while already down
+  void up();       // Link established
+  bool isUp() const { return !down_; }
+  uint32_t connects() const { return connects_; }
+  uint32_t retries() const { return retries_; }
+  uint16_t lastRetries() const { return lastRetries_; } // Of the outage that ended last
+  uint32_t lastDownMs() const { return lastDownMs_; }
+  uint32_t maxDownMs() const { return maxDownMs_; }
+
+ private:
+  uint32_t base_, cap_;
+  bool down_ = true; // Until the first connect, timed from boot
+  uint32_t downSince_ = 0;
+  uint16_t streak_ = 0; // Retries in the current outage
+  uint16_t lastRetries_ = 0;
+  uint32_t connects_ = 0;
+  uint32_t retries_ = 0;
+  uint32_t lastDownMs_ = 0;
+  uint32_t maxDownMs_ = 0;
+};
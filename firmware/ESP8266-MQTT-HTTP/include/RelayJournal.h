@@ -0,0 +1,34 @@
+#pragma once
+#include <Arduino.h>
+
+#define JOURNAL_SECTORS 4 // Taken from the start of the (unused) FS region
+
+/* =======================
+   Append-only log of the relay channel bitmask. Each change is one 4-byte
+   flash write; a sector is erased only when the ring rotates into it, so
+   ~1000 toggles cost one erase instead of one each.
+   ======================= */
+class RelayJournal {
+ public:
+  bool begin();  // False when the flash layout has no spare sectors
+  bool ready() const { return ready_; }
+  bool read(uint8_t& state) const;
+  bool append(uint8_t state);
+  uint32_t appends() const { return appends_; }
+  uint32_t erases() const { return erases_; }
+
+ private:
+  uint32_t sectorAddr(uint8_t index) const;
+  uint32_t readWord(uint32_t addr) const;
+  bool sectorSeq(uint8_t index, uint32_t& seq) const;
+  bool openSector(uint8_t index, uint32_t seq);
+  uint32_t findEnd(uint32_t base) const;
+  bool lastRecord(uint8_t index, uint32_t end, uint8_t& state) const;
+  bool ready_ = false;
+  bool hasState_ = false;
+  uint8_t state_ = 0;
+  uint8_t active_ = 0;
+  uint32_t seq_ = 0;
+  uint32_t offset_ = 0; // Next free record in the active sector
+  uint32_t appends_ = 0, erases_ = 0;
+};
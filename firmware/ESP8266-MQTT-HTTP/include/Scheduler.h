@@ -0,0 +1,62 @@
+#pragma once
+#include <Arduino.h>
+
+#ifndef SCHED_MAX_TASKS
+#define SCHED_MAX_TASKS 10 // main.cpp uses 9; its TIMERS table is checked against this
+#endif
+
+/* =======================
+   Cooperative timers for loop(). Periodic and one-shot tasks sit in a
+   fixed min-heap ordered by deadline, so a pass only looks at the
+   earliest one and an idle loop() knows how long it may sleep. Tasks run
+   to completion from run() in deadline order. Each one records how late
+   it ran, its period jitter and its run time, so a slow neighbour shows
+   up as a late timer rather than a mystery.
+   ======================= */
+class Scheduler {
+ public:
+  typedef void (*TaskFn)();
+  struct Stats {
+    uint32_t runs;
+    uint32_t lateMax;   // ms past the deadline, since resetMax()
+    uint32_t lateAvg;   // us, EWMA 1/16 weight
+    uint32_t jitterAvg; // us, |interval - period|, EWMA 1/16; periodic only
+    uint32_t runMax;    // us, since resetMax()
+  };
+
+  // Every `period` ms, the first run after `first`. -1 when full.
+  int8_t every(const char* name, TaskFn fn, uint32_t period, uint32_t first);
+  // Idle until wake(). -1 when full.
+  int8_t once(const char* name, TaskFn fn);
+  void wake(int8_t id, uint32_t delay); // Due within `delay` ms; an earlier deadline is kept
+  void cancel(int8_t id);
+  bool pending(int8_t id) const { return id >= 0 && pos_[id] >= 0; }
+  void run(); // From loop(): every task that is due
+  uint32_t idle() const; // ms until the next deadline; UINT32_MAX when nothing is armed
+  uint8_t size() const { return count_; }
+  const char* name(uint8_t id) const { return tasks_[id].name; }
+  const Stats& stats(uint8_t id) const { return tasks_[id].stats; }
+  void resetMax();
+
+ private:
+  struct Task {
+    const char* name;
+    TaskFn fn;
+    uint32_t period; // 0 = one-shot
+    uint32_t deadline;
+    uint32_t lastRun;
+    Stats stats;
+  };
+  int8_t add(const char* name, TaskFn fn, uint32_t period);
+  bool before(uint8_t a, uint8_t b) const { return (int32_t)(tasks_[heap_[a]].deadline - tasks_[heap_[b]].deadline) < 0; }
+  void swap(uint8_t a, uint8_t b);
+  void siftUp(uint8_t i);
+  void siftDown(uint8_t i);
+  void push(uint8_t id);
+  void removeAt(uint8_t i);
+  Task tasks_[SCHED_MAX_TASKS];
+  uint8_t heap_[SCHED_MAX_TASKS]; // Task ids, earliest deadline first
+  int8_t pos_[SCHED_MAX_TASKS];   // Heap index per task, -1 when not armed
+  uint8_t count_ = 0;
+  uint8_t heapSize_ = 0;
+};
@@ -0,0 +1,33 @@
+#pragma once
+#include <Arduino.h>
+
+#ifndef MAX_TOPIC_ROUTES
+#define MAX_TOPIC_ROUTES 11 // Command + one per channel (up to 8) + group + config
+#endif
+
+typedef void (*TopicHandler)(uint8_t arg, byte* payload, unsigned int len);
+
+/* =======================
+   MQTT topic dispatch table. Topic hashes (FNV-1a) are computed once when a
+   route is added, so an incoming message costs one hash plus one confirming
+   strcmp. Topic strings are not copied and must outlive the routes.
+   ======================= */
+class TopicRouter {
+ public:
+  void clear() { count_ = 0; }
+  bool add(const char* topic, TopicHandler fn, uint8_t arg = 0);
+  bool dispatch(const char* topic, byte* payload, unsigned int len) const;
+  uint8_t size() const { return count_; }
+  const char* topic(uint8_t index) const { return routes_[index].topic; }
+  static uint32_t hash(const char* s);
+
+ private:
+  struct Route {
+    uint32_t hash;
+    const char* topic;
+    TopicHandler fn;
+    uint8_t arg;
+  };
+  Route routes_[MAX_TOPIC_ROUTES];
+  uint8_t count_ = 0;
+};
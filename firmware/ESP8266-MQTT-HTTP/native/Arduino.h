@@ -0,0 +1,95 @@
+#pragma once
+/* =======================
+   Host stand-in for the ESP8266 Arduino core (env:native only)
+   ======================= */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <functional>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x00
+#define OUTPUT 0x01
+#define INPUT_PULLUP 0x02
+
+#ifndef F_CPU
+#define F_CPU 80000000L
+#endif
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define memcpy_P memcpy
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+// GPIO output set/clear registers (esp8266_peri.h); 1 bits drive pins 0-15.
+struct HostGpioReg {
+  uint8_t level;
+  HostGpioReg& operator=(uint32_t bits);
+};
+extern HostGpioReg GPOS, GPOC;
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+class String {
+ public:
+  String(const char* s = "") : s_(s ? s : "") {}
+  String(const std::string& s) : s_(s) {}
+  String(char c) : s_(1, c) {}
+  String(int v) : s_(std::to_string(v)) {}
+  String(unsigned int v) : s_(std::to_string(v)) {}
+  String(long v) : s_(std::to_string(v)) {}
+  String(unsigned long v) : s_(std::to_string(v)) {}
+  const char* c_str() const { return s_.c_str(); }
+  unsigned int length() const { return (unsigned int)s_.size(); }
+  long toInt() const { return strtol(s_.c_str(), nullptr, 10); }
+  bool equals(const String& o) const { return s_ == o.s_; }
+  bool operator==(const String& o) const { return s_ == o.s_; }
+  bool operator==(const char* o) const { return s_ == (o ? o : ""); }
+  bool operator!=(const String& o) const { return s_ != o.s_; }
+  String& operator+=(const String& o) { s_ += o.s_; return *this; }
+  String& operator+=(const char* o) { s_ += (o ? o : ""); return *this; }
+  String& operator+=(char c) { s_ += c; return *this; }
+  friend String operator+(const String& a, const String& b) { return String(a.s_ + b.s_); }
+  friend String operator+(const String& a, const char* b) { return String(a.s_ + (b ? b : "")); }
+  friend String operator+(const char* a, const String& b) { return String((a ? a : "") + b.s_); }
+ private:
+  std::string s_;
+};
+
+class EspClass {
+ public:
+  uint32_t getFreeHeap();
+  uint32_t getMaxFreeBlockSize();
+  uint8_t getHeapFragmentation();
+  uint32_t getChipId();
+  uint8_t getCpuFreqMHz() { return F_CPU / 1000000L; }
+  uint32_t getCycleCount();
+  bool flashEraseSector(uint32_t sector);
+  bool flashWrite(uint32_t address, const uint32_t* data, size_t size);
+  bool flashRead(uint32_t address, uint32_t* data, size_t size);
+  bool rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size);  // offset in 4-byte blocks
+  bool rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size);
+  [[noreturn]] void restart();
+};
+extern EspClass ESP;
@@ -0,0 +1,29 @@
+#pragma once
+#include "Arduino.h"
+
+// Backed by the simulated flash image, one sector like the real core.
+class EEPROMClass {
+ public:
+  void begin(size_t size);
+  bool commit();
+  bool end();
+  uint8_t read(int address) const { return data_[address]; }
+  void write(int address, uint8_t value) { data_[address] = value; dirty_ = true; }
+  uint8_t* getDataPtr() { dirty_ = true; return data_; }
+  const uint8_t* getConstDataPtr() const { return data_; }
+  size_t length() const { return size_; }
+  template <typename T> T& get(int address, T& t) {
+    memcpy(&t, data_ + address, sizeof(T));
+    return t;
+  }
+  template <typename T> const T& put(int address, const T& t) {
+    memcpy(data_ + address, &t, sizeof(T));
+    dirty_ = true;
+    return t;
+  }
+ private:
+  uint8_t data_[4096];
+  size_t size_ = 0;
+  bool dirty_ = false;
+};
+extern EEPROMClass EEPROM;
@@ -0,0 +1,68 @@
+#pragma once
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "Client.h"
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } WiFiMode_t;
+typedef enum { WIFI_NONE_SLEEP = 0, WIFI_LIGHT_SLEEP = 1, WIFI_MODEM_SLEEP = 2 } WiFiSleepType_t;
+
+class ESP8266WiFiClass {
+ public:
+  bool mode(WiFiMode_t m) { mode_ = m; return true; }
+  WiFiMode_t getMode() const { return mode_; }
+  bool softAP(const char* ssid, const char* pass = nullptr);
+  bool softAPdisconnect(bool wifioff = false);
+  wl_status_t begin(const char* ssid, const char* pass = nullptr, int32_t channel = 0, const uint8_t* bssid = nullptr, bool connect = true);
+  bool config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress(), IPAddress dns2 = IPAddress());
+  bool disconnect(bool wifioff = false);
+  wl_status_t status();
+  int32_t RSSI();
+  IPAddress localIP();
+  IPAddress gatewayIP();
+  IPAddress subnetMask();
+  IPAddress dnsIP(uint8_t n = 0);
+  uint8_t* BSSID();
+  int32_t channel();
+  bool hostByName(const char* host, IPAddress& result, uint32_t timeout_ms = 10000);
+  bool setSleepMode(WiFiSleepType_t type, uint8_t listenInterval = 0) {
+    sleep_ = type;
+    listen_ = listenInterval;
+    return true;
+  }
+  WiFiSleepType_t getSleepMode() const { return sleep_; }
+  uint8_t getListenInterval() const { return listen_; }
+ private:
+  WiFiMode_t mode_ = WIFI_OFF;
+  WiFiSleepType_t sleep_ = WIFI_NONE_SLEEP;
+  uint8_t listen_ = 0;
+};
+extern ESP8266WiFiClass WiFi;
+
+// Always dials the simulated broker; a dead broker blocks for the full
+// connect timeout like the real WiFiClient.
+class WiFiClient : public Client {
+ public:
+  int connect(IPAddress, uint16_t) override { return dial(); }
+  int connect(const char*, uint16_t) override { return dial(); }
+  size_t write(uint8_t) override { return 0; }
+  size_t write(const uint8_t*, size_t) override { return 0; }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int read(uint8_t*, size_t) override { return -1; }
+  int peek() override { return -1; }
+  void flush() override {}
+  void stop() override { open_ = false; }
+  uint8_t connected() override;
+  operator bool() override { return connected(); }
+ private:
+  int dial();
+  bool open_ = false;
+};
@@ -0,0 +1,13 @@
+#pragma once
+#include "Arduino.h"
+
+class MDNSResponder {
+ public:
+  bool begin(const char* hostname) { running_ = hostname && *hostname; return running_; }
+  bool end() { bool was = running_; running_ = false; return was; } // False when it never started, like LEAmDNS
+  bool update() { return running_; }
+  bool isRunning() const { return running_; }
+ private:
+  bool running_ = false;
+};
+extern MDNSResponder MDNS;
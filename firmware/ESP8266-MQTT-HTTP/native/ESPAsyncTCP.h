@@ -0,0 +1,88 @@
+#pragma once
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "lwip/dns.h"
+
+class AsyncClient;
+
+// lwIP variant the firmware is built against: the core's default "Lower
+// Memory" build, or "Higher Bandwidth" (esp12e).
+#ifdef PIO_FRAMEWORK_ARDUINO_LWIP2_HIGHER_BANDWIDTH
+#define TCP_MSS 1460
+#else
+#define TCP_MSS 536
+#endif
+#define TCP_SND_BUF (2 * TCP_MSS)
+
+typedef std::function<void(void*, AsyncClient*)> AcConnectHandler;
+typedef std::function<void(void*, AsyncClient*, size_t len, uint32_t time)> AcAckHandler;
+typedef std::function<void(void*, AsyncClient*, err_t error)> AcErrorHandler;
+typedef std::function<void(void*, AsyncClient*, void* data, size_t len)> AcDataHandler;
+typedef std::function<void(void*, AsyncClient*, uint32_t time)> AcTimeoutHandler;
+
+// Same surface as me-no-dev/ESPAsyncTCP; outbound connections reach the
+// simulated broker, inbound ones come from the simulated browser, and
+// callbacks fire from HostSim::pumpNetwork().
+class AsyncClient {
+ public:
+  AsyncClient();
+  ~AsyncClient();
+  bool connect(IPAddress ip, uint16_t port);
+  void close(bool now = false);
+  void abort() { close(true); }
+  bool connected() const { return state_ == CONNECTED; }
+  bool connecting() const { return state_ == CONNECTING; }
+  bool disconnected() const { return state_ == IDLE; }
+  size_t space() const { return connected() ? SND_BUF - unsent_ - inflight_ : 0; }
+  bool canSend() const { return space() > 0; }
+  size_t add(const char* data, size_t size, uint8_t apiflags = 0);
+  bool send();
+  size_t write(const char* data, size_t size) { return add(data, size); }
+  void setNoDelay(bool) {}
+  void setRxTimeout(uint32_t) {}
+  void onConnect(AcConnectHandler cb, void* arg = nullptr) { connectCb_ = cb; connectArg_ = arg; }
+  void onDisconnect(AcConnectHandler cb, void* arg = nullptr) { disconnectCb_ = cb; disconnectArg_ = arg; }
+  void onAck(AcAckHandler cb, void* arg = nullptr) { ackCb_ = cb; ackArg_ = arg; }
+  void onError(AcErrorHandler cb, void* arg = nullptr) { errorCb_ = cb; errorArg_ = arg; }
+  void onData(AcDataHandler cb, void* arg = nullptr) { dataCb_ = cb; dataArg_ = arg; }
+  void onTimeout(AcTimeoutHandler cb, void* arg = nullptr) { timeoutCb_ = cb; timeoutArg_ = arg; }
+  void onPoll(AcConnectHandler cb, void* arg = nullptr) { pollCb_ = cb; pollArg_ = arg; }
+
+  // Simulator only
+  void pump();
+  void accept(int8_t peer);
+  void deliver(const char* data, size_t len) { if (dataCb_) dataCb_(dataArg_, this, (void*)data, len); }
+
+ private:
+  static constexpr size_t SND_BUF = TCP_SND_BUF;
+  uint32_t rttMs() const;  // Until the peer acks: browser on the LAN, or the broker
+  enum State : uint8_t { IDLE, CONNECTING, CONNECTED };
+  State state_ = IDLE;
+  int8_t peer_ = -1;        // Inbound: simulated browser slot
+  size_t unsent_ = 0;       // Added since the last send()
+  size_t inflight_ = 0;     // Sent, not yet acked by the peer
+  uint32_t ackDueMs_ = 0;
+  uint32_t connectStartMs_ = 0;
+  AcConnectHandler connectCb_, disconnectCb_, pollCb_;
+  AcAckHandler ackCb_;
+  AcErrorHandler errorCb_;
+  AcDataHandler dataCb_;
+  AcTimeoutHandler timeoutCb_;
+  void *connectArg_ = nullptr, *disconnectArg_ = nullptr, *pollArg_ = nullptr, *ackArg_ = nullptr;
+  void *errorArg_ = nullptr, *dataArg_ = nullptr, *timeoutArg_ = nullptr;
+};
+
+class AsyncServer {
+ public:
+  explicit AsyncServer(uint16_t port) : port_(port) {}
+  void onClient(AcConnectHandler cb, void* arg) { clientCb_ = cb; clientArg_ = arg; }
+  void setNoDelay(bool) {}
+  void begin();
+  void end();
+  void accept(AsyncClient* c) { if (clientCb_) clientCb_(clientArg_, c); }  // Simulator only
+
+ private:
+  uint16_t port_;
+  AcConnectHandler clientCb_;
+  void* clientArg_ = nullptr;
+};
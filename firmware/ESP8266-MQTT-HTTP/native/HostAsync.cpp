@@ -0,0 +1,259 @@
+/* =======================
+   Host simulator async TCP (ESPAsyncTCP) and lwIP DNS. Events are
+   delivered from pumpNetwork(), which stands in for the SYS task: it
+   runs between loop() passes and whenever the sketch yields.
+   ======================= */
+#include "HostSim.h"
+#include "ESP8266WiFi.h"
+#include "ESPAsyncTCP.h"
+#include <algorithm>
+
+namespace {
+
+constexpr size_t MAX_CLIENTS = 16;
+AsyncClient* gClients[MAX_CLIENTS];
+
+// Simulated browser connections. More than the server has slots, so
+// overload shows up as 503s rather than queueing here. Like a browser, a
+// peer whose response is complete keeps the connection and sends the next
+// request on it until the server closes it. An event stream holds its
+// peer for good.
+constexpr size_t MAX_PEERS = 8;
+constexpr uint32_t LAN_RTT_MS = 2;
+struct Peer {
+  bool active;  // Connection open
+  bool busy;    // Request outstanding
+  AsyncClient* client;
+  char request[640];
+  size_t len, fed;
+  uint32_t nextFeedMs;
+  uint64_t startUs;
+  char head[256];  // Start of the response
+  size_t headLen;
+  size_t bodyLeft;  // Of Content-Length, once the head is complete
+  bool chunked;
+  bool stream;  // text/event-stream: every later byte is events
+} gPeers[MAX_PEERS];
+AsyncServer* gServer = nullptr;
+
+Peer* freePeer() {
+  for (Peer& p : gPeers) {
+    if (p.active && !p.busy && !p.stream) return &p;
+  }
+  for (Peer& p : gPeers) {
+    if (!p.active) return &p;
+  }
+  return nullptr;
+}
+
+void acceptPeers() {
+  while (gServer) {
+    Peer* p = freePeer();
+    HostSim::HttpRequest req;
+    if (!p || !HostSim::nextHttpRequest(req)) return;
+    bool post = !strcmp(req.method, "POST");
+    char length[32] = "";
+    if (post) snprintf(length, sizeof(length), "Content-Length: %u\r\n", (unsigned)strlen(req.body));
+    p->len = snprintf(p->request, sizeof(p->request),
+                      "%s %s HTTP/1.1\r\nHost: bedtimeesp.local\r\n"
+                      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 Chrome/120.0 Safari/537.36\r\n"
+                      "Accept: */*\r\nAccept-Encoding: gzip, deflate\r\n%s%s%s%s\r\n%s",
+                      req.method, req.uri, req.ifNoneMatch[0] ? "If-None-Match: " : "", req.ifNoneMatch,
+                      req.ifNoneMatch[0] ? "\r\n" : "", length, post ? req.body : "");
+    if (p->len >= sizeof(p->request)) p->len = sizeof(p->request) - 1;
+    p->busy = true;
+    p->fed = 0;
+    p->nextFeedMs = 0;
+    p->startUs = HostSim::nowUs();
+    p->headLen = 0;
+    p->head[0] = '\0';
+    p->bodyLeft = (size_t)-1;
+    p->chunked = false;
+    if (p->active) continue;
+    p->active = true;
+    HostSim::counters().httpConnections++;
+    p->client = new AsyncClient();  // ESPAsyncTCP allocates one per accepted pcb too
+    p->client->accept((int8_t)(p - gPeers));
+    gServer->accept(p->client);
+  }
+}
+
+void feedPeers() {
+  uint32_t slow = HostSim::knobs().httpSlowMs;
+  for (Peer& p : gPeers) {
+    if (!p.busy || p.fed == p.len || HostSim::nowMs() < p.nextFeedMs) continue;
+    size_t n = slow ? std::min<size_t>(16, p.len - p.fed) : p.len - p.fed;
+    p.fed += n;
+    p.nextFeedMs = HostSim::nowMs() + slow;
+    p.client->deliver(p.request + p.fed - n, n);
+  }
+}
+
+void responseDone(Peer& p) {
+  p.busy = false;
+  HostSim::httpResponseDone(p.startUs, p.head);
+}
+
+// Response bytes as they reach the browser: keep the head, then count the
+// body down (or watch for the last chunk) to find where a persistent
+// response ends.
+void receive(Peer& p, const char* data, size_t n) {
+  if (p.stream) {
+    for (const char* e = data; (e = (const char*)memmem(e, n - (e - data), "event: ", 7)); e += 7) HostSim::httpEvent();
+    return;
+  }
+  if (!p.busy) return;
+  if (p.chunked) {
+    if (n >= 5 && !memcmp(data + n - 5, "0\r\n\r\n", 5)) responseDone(p);
+    return;
+  }
+  if (p.bodyLeft == (size_t)-1) {
+    size_t keep = std::min(n, sizeof(p.head) - 1 - p.headLen);
+    memcpy(p.head + p.headLen, data, keep);
+    p.headLen += keep;
+    p.head[p.headLen] = '\0';
+    const char* end = strstr(p.head, "\r\n\r\n");
+    if (!end) return;
+    if (strstr(p.head, "\r\nContent-Type: text/event-stream")) {
+      responseDone(p);
+      p.stream = true;
+      return receive(p, end + 4, p.headLen - (end + 4 - p.head));
+    }
+    p.chunked = strstr(p.head, "\r\nTransfer-Encoding: chunked") != nullptr;
+    if (p.chunked) return receive(p, end + 4, p.headLen - (end + 4 - p.head));
+    const char* cl = strstr(p.head, "\r\nContent-Length: ");
+    size_t body = cl && cl < end ? strtoul(cl + 18, nullptr, 10) : 0;
+    size_t got = p.headLen - (end + 4 - p.head) + (n - keep);
+    p.bodyLeft = body > got ? body - got : 0;
+  } else {
+    p.bodyLeft -= std::min(n, p.bodyLeft);
+  }
+  if (!p.bodyLeft) responseDone(p);
+}
+
+struct PendingDns {
+  bool active;
+  uint32_t dueMs;
+  char name[64];
+  dns_found_callback found;
+  void* arg;
+} gDns;
+
+}  // namespace
+
+AsyncClient::AsyncClient() {
+  for (AsyncClient*& c : gClients) {
+    if (!c) { c = this; break; }
+  }
+}
+
+AsyncClient::~AsyncClient() {
+  for (AsyncClient*& c : gClients) {
+    if (c == this) c = nullptr;
+  }
+}
+
+bool AsyncClient::connect(IPAddress, uint16_t) {
+  if (state_ != IDLE || WiFi.status() != WL_CONNECTED) return false;
+  state_ = CONNECTING;
+  connectStartMs_ = HostSim::nowMs();
+  return true;
+}
+
+void AsyncClient::accept(int8_t peer) {
+  state_ = CONNECTED;
+  peer_ = peer;
+}
+
+void AsyncClient::close(bool) {
+  if (state_ == IDLE) return;
+  state_ = IDLE;
+  unsent_ = inflight_ = 0;
+  ackDueMs_ = 0;
+  if (peer_ >= 0) {
+    Peer& p = gPeers[peer_];
+    p.active = p.stream = false;
+    if (p.busy) responseDone(p);  // Chunked body, or cut short
+    peer_ = -1;
+  }
+  if (disconnectCb_) disconnectCb_(disconnectArg_, this);  // May delete this
+}
+
+uint32_t AsyncClient::rttMs() const { return peer_ >= 0 ? LAN_RTT_MS : HostSim::knobs().brokerRttMs; }
+
+size_t AsyncClient::add(const char* data, size_t size, uint8_t) {
+  if (!connected()) return 0;
+  size_t n = size < space() ? size : space();
+  if (peer_ >= 0) {
+    receive(gPeers[peer_], data, n);
+    HostSim::counters().httpBytes += n;
+  }
+  unsent_ += n;  // Outbound (broker) data holds the send buffer too
+  return n;
+}
+
+bool AsyncClient::send() {
+  if (!connected()) return false;
+  if (unsent_) {
+    if (peer_ >= 0) HostSim::counters().httpSegments += (unsent_ + TCP_MSS - 1) / TCP_MSS;
+    inflight_ += unsent_;
+    unsent_ = 0;
+    if (!ackDueMs_) ackDueMs_ = HostSim::nowMs() + rttMs();
+  }
+  return true;
+}
+
+void AsyncClient::pump() {
+  const HostSim::Knobs& k = HostSim::knobs();
+  bool reachable = WiFi.status() == WL_CONNECTED && HostSim::brokerUp();
+  if (state_ == CONNECTING) {
+    uint32_t elapsed = HostSim::nowMs() - connectStartMs_;
+    if (reachable && elapsed >= k.brokerRttMs / 2) {
+      state_ = CONNECTED;
+      if (connectCb_) connectCb_(connectArg_, this);
+    } else if (!reachable && elapsed >= k.connectTimeoutMs) {
+      if (errorCb_) errorCb_(errorArg_, this, ERR_ABRT);
+      close(true);
+    }
+  } else if (peer_ < 0 && state_ == CONNECTED && !reachable) {
+    close(true);
+  } else if (inflight_ && HostSim::nowMs() >= ackDueMs_) {
+    size_t acked = inflight_;
+    inflight_ = 0;
+    ackDueMs_ = 0;
+    if (ackCb_) ackCb_(ackArg_, this, acked, rttMs());
+  }
+}
+
+void AsyncServer::begin() { gServer = this; }
+
+void AsyncServer::end() {
+  if (gServer == this) gServer = nullptr;
+}
+
+err_t dns_gethostbyname(const char* hostname, ip_addr_t*, dns_found_callback found, void* callback_arg) {
+  if (!hostname || !*hostname || gDns.active) return ERR_ARG;
+  gDns.active = true;
+  gDns.dueMs = HostSim::nowMs() + 2;
+  snprintf(gDns.name, sizeof(gDns.name), "%s", hostname);
+  gDns.found = found;
+  gDns.arg = callback_arg;
+  return ERR_INPROGRESS;
+}
+
+namespace HostSim {
+
+void pumpNetwork() {
+  if (gDns.active && nowMs() >= gDns.dueMs) {
+    gDns.active = false;
+    ip_addr_t addr = {IPAddress(192, 168, 1, 2)};
+    gDns.found(gDns.name, WiFi.status() == WL_CONNECTED ? &addr : nullptr, gDns.arg);
+  }
+  acceptPeers();
+  feedPeers();
+  for (AsyncClient* c : gClients) {
+    if (c) c->pump();
+  }
+}
+
+}  // namespace HostSim
@@ -0,0 +1,288 @@
+/* =======================
+   Host simulator network: station/AP, mDNS and MQTT broker.
+   Blocking calls cost the same wall time they would on the device.
+   ======================= */
+#include "HostSim.h"
+#include "ESP8266WiFi.h"
+#include "ESP8266mDNS.h"
+#include "PubSubClient.h"
+
+ESP8266WiFiClass WiFi;
+MDNSResponder MDNS;
+
+namespace {
+
+bool gApUp = false;
+bool gStaConfigured = false;
+uint32_t gStaBeginMs = 0;
+uint32_t gStaJoinMs = 0;    // Time this begin() needs to associate
+bool gStaJoinable = false;  // False when it named another channel/BSSID
+uint32_t gStaticIp = 0;     // WiFi.config(): DHCP skipped
+uint8_t gApBssid[6] = {0x02, 0xBE, 0xD7, 0x1E, 0x00, 0x01};
+constexpr uint32_t JOIN_MS = 150;  // Auth + assoc on a known channel
+
+constexpr size_t MAX_SUBSCRIPTIONS = 16;
+char gSubscriptions[MAX_SUBSCRIPTIONS][128];
+size_t gSubscriptionCount = 0;
+bool gSessionUp = false;
+
+bool subscribed(const char* topic) {
+  for (size_t i = 0; i < gSubscriptionCount; i++) {
+    if (!strcmp(gSubscriptions[i], topic)) return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+/* =======================
+   WiFi
+   ======================= */
+namespace {
+
+// Rough ESP8266EX figures: radio listening with the CPU on; modem sleep
+// (CPU on, radio off); light sleep (both paused while loop() idles in
+// delay()); and the radio on for about 3 ms at each beacon wake-up.
+constexpr uint64_t ACTIVE_UA = 70000, MODEM_UA = 15000, LIGHT_UA = 900;
+constexpr uint64_t WAKE_US = 3000, BEACON_US = 102400;
+
+// The SDK only sleeps in pure STA mode, with the station associated.
+WiFiSleepType_t radioSleep() {
+  if (gApUp || WiFi.status() != WL_CONNECTED) return WIFI_NONE_SLEEP;
+  return WiFi.getSleepMode();
+}
+
+uint64_t wakePeriodUs() {
+  uint8_t listen = WiFi.getListenInterval();
+  return BEACON_US * (listen ? listen : 1);
+}
+
+}  // namespace
+
+namespace HostSim {
+
+uint64_t radioReadyUs(uint64_t arrivalUs) {
+  if (radioSleep() == WIFI_NONE_SLEEP) return arrivalUs;
+  uint64_t period = wakePeriodUs();
+  return (arrivalUs / period + 1) * period;
+}
+
+void chargePower(uint64_t us, bool idle) {
+  Counters& c = counters();
+  if (idle) c.idleUs += us;
+  WiFiSleepType_t mode = radioSleep();
+  if (mode == WIFI_NONE_SLEEP) {
+    c.chargeUaUs += ACTIVE_UA * us;
+    return;
+  }
+  c.sleepUs += us;
+  uint64_t base = (mode == WIFI_LIGHT_SLEEP && idle) ? LIGHT_UA : MODEM_UA;
+  c.chargeUaUs += base * us + (ACTIVE_UA - MODEM_UA) * WAKE_US * us / wakePeriodUs();
+}
+
+void reportPower() {
+  const Counters& c = counters();
+  static const char* const MODES[] = {"none", "light", "modem"};
+  uint64_t total = nowUs();
+  printf("power     mode=%s listen=%u asleep=%llu%% idle=%llu%% avg_current=%.1fmA (model)\n",
+         MODES[WiFi.getSleepMode()], WiFi.getListenInterval(),
+         (unsigned long long)(total ? c.sleepUs * 100 / total : 0),
+         (unsigned long long)(total ? c.idleUs * 100 / total : 0),
+         total ? c.chargeUaUs / (double)total / 1000.0 : 0.0);
+}
+
+}  // namespace HostSim
+bool ESP8266WiFiClass::softAP(const char* ssid, const char*) {
+  gApUp = ssid && *ssid;
+  return gApUp;
+}
+
+bool ESP8266WiFiClass::softAPdisconnect(bool) {
+  gApUp = false;
+  return true;
+}
+
+// Full begin(): scan + join + DHCP. A channel and BSSID skip the scan and
+// only work when they match the AP; a static config skips DHCP.
+wl_status_t ESP8266WiFiClass::begin(const char* ssid, const char*, int32_t channel, const uint8_t* bssid, bool) {
+  const HostSim::Knobs& k = HostSim::knobs();
+  gStaConfigured = ssid && *ssid;
+  gStaBeginMs = HostSim::nowMs();
+  gApBssid[5] = k.wifiChannel;
+  bool direct = channel && bssid;
+  gStaJoinable = !direct || (channel == k.wifiChannel && !memcmp(bssid, gApBssid, 6));
+  gStaJoinMs = (direct ? JOIN_MS : k.wifiAssocMs - k.wifiDhcpMs) + (gStaticIp ? 0 : k.wifiDhcpMs);
+  HostSim::counters().wifiBegins++;
+  if (direct) HostSim::counters().wifiDirect++;
+  return status();
+}
+
+bool ESP8266WiFiClass::disconnect(bool) {
+  gStaConfigured = false;
+  return true;
+}
+
+// An AP outage drops the station; it needs a WiFi.begin() after the AP is back.
+wl_status_t ESP8266WiFiClass::status() {
+  if (!gStaConfigured) return WL_IDLE_STATUS;
+  const HostSim::Knobs& k = HostSim::knobs();
+  uint32_t now = HostSim::nowMs();
+  if (now >= k.wifiOutageStartMs && gStaBeginMs < k.wifiOutageEndMs && k.wifiOutageEndMs) return WL_DISCONNECTED;
+  if (!gStaJoinable || now - gStaBeginMs < gStaJoinMs) return WL_DISCONNECTED;
+  HostSim::Counters& c = HostSim::counters();
+  if (!c.wifiUpMs) c.wifiUpMs = now;
+  if (k.wifiOutageEndMs && now >= k.wifiOutageEndMs && !c.wifiReupMs) c.wifiReupMs = now - k.wifiOutageEndMs;
+  return WL_CONNECTED;
+}
+
+bool ESP8266WiFiClass::config(IPAddress local, IPAddress, IPAddress, IPAddress, IPAddress) {
+  gStaticIp = local;
+  return true;
+}
+
+int32_t ESP8266WiFiClass::RSSI() { return status() == WL_CONNECTED ? -61 : 31; }
+
+IPAddress ESP8266WiFiClass::localIP() { return status() == WL_CONNECTED ? (gStaticIp ? IPAddress(gStaticIp) : IPAddress(192, 168, 1, 50)) : IPAddress(); }
+IPAddress ESP8266WiFiClass::gatewayIP() { return status() == WL_CONNECTED ? IPAddress(192, 168, 1, 1) : IPAddress(); }
+IPAddress ESP8266WiFiClass::subnetMask() { return status() == WL_CONNECTED ? IPAddress(255, 255, 255, 0) : IPAddress(); }
+IPAddress ESP8266WiFiClass::dnsIP(uint8_t) { return status() == WL_CONNECTED ? IPAddress(192, 168, 1, 1) : IPAddress(); }
+uint8_t* ESP8266WiFiClass::BSSID() { return gApBssid; }
+int32_t ESP8266WiFiClass::channel() { return status() == WL_CONNECTED ? HostSim::knobs().wifiChannel : 0; }
+
+bool ESP8266WiFiClass::hostByName(const char* host, IPAddress& result, uint32_t) {
+  if (status() != WL_CONNECTED || !host || !*host) return false;
+  if (!result.fromString(host)) result = IPAddress(192, 168, 1, 2);
+  return true;
+}
+
+int WiFiClient::dial() {
+  if (WiFi.status() != WL_CONNECTED) return 0;
+  if (!HostSim::brokerUp()) {
+    HostSim::sleepUs(HostSim::knobs().connectTimeoutMs * 1000ULL);
+    return 0;
+  }
+  HostSim::sleepUs(HostSim::knobs().brokerRttMs * 500ULL);  // SYN -> SYN/ACK
+  open_ = true;
+  return 1;
+}
+
+uint8_t WiFiClient::connected() {
+  if (open_ && (WiFi.status() != WL_CONNECTED || !HostSim::brokerUp())) open_ = false;
+  return open_;
+}
+
+/* =======================
+   MQTT broker
+   ======================= */
+PubSubClient& PubSubClient::setServer(IPAddress, uint16_t port) {
+  domain_[0] = '\0';
+  port_ = port;
+  return *this;
+}
+
+PubSubClient& PubSubClient::setServer(const char* domain, uint16_t port) {
+  snprintf(domain_, sizeof(domain_), "%s", domain ? domain : "");
+  port_ = port;
+  return *this;
+}
+
+bool PubSubClient::setBufferSize(uint16_t size) {
+  if (!size) return false;
+  bufferSize_ = size;
+  return true;
+}
+
+bool PubSubClient::connect(const char*, const char*, const char*, const char*, uint8_t, bool, const char*, bool) {
+  if (connected()) return true;
+  HostSim::Counters& c = HostSim::counters();
+  // Like the real client, reuse an already open socket and dial otherwise.
+  if (!client_->connected() && !client_->connect(domain_, port_)) {
+    c.mqttConnectFails++;
+    state_ = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  uint8_t packet[64] = {0x10};
+  client_->write(packet, sizeof(packet));  // CONNECT
+  if (!HostSim::brokerUp()) {
+    HostSim::sleepUs(socketTimeout_ * 1000000ULL);
+    client_->stop();
+    c.mqttConnectFails++;
+    state_ = MQTT_CONNECTION_TIMEOUT;
+    return false;
+  }
+  HostSim::sleepUs(HostSim::knobs().brokerRttMs * 1000ULL);  // CONNECT -> CONNACK
+  gSubscriptionCount = 0;
+  gSessionUp = true;
+  state_ = MQTT_CONNECTED;
+  c.mqttConnects++;
+  return true;
+}
+
+void PubSubClient::disconnect() {
+  if (client_->connected()) client_->stop();
+  gSessionUp = false;
+  gSubscriptionCount = 0;
+  state_ = MQTT_DISCONNECTED;
+}
+
+bool PubSubClient::connected() {
+  if (state_ == MQTT_CONNECTED && (!gSessionUp || !client_->connected() || !HostSim::brokerUp())) {
+    gSessionUp = false;
+    gSubscriptionCount = 0;
+    HostSim::dropBrokerSession();
+    state_ = MQTT_CONNECTION_LOST;
+  }
+  return state_ == MQTT_CONNECTED;
+}
+
+bool PubSubClient::publish(const char* topic, const char* payload, bool retained) {
+  return publish(topic, (const uint8_t*)payload, payload ? strlen(payload) : 0, retained);
+}
+
+bool PubSubClient::publish(const char* topic, const uint8_t*, unsigned int plength, bool) {
+  if (!connected()) return false;
+  size_t packet = 5 + 2 + strlen(topic) + plength;
+  if (packet > bufferSize_) return false;  // Same limit as the real client
+  static uint8_t frame[UINT16_MAX];  // Content is not inspected; the socket only counts it
+  if (client_->write(frame, packet) != packet) return false;  // Send buffer full, as on lwIP
+  HostSim::Counters& c = HostSim::counters();
+  c.mqttPublishes++;
+  c.mqttPublishBytes += packet;
+  return true;
+}
+
+bool PubSubClient::subscribe(const char* topic, uint8_t) {
+  if (!connected() || !topic || strlen(topic) + 9 > bufferSize_) return false;
+  if (subscribed(topic)) return true;
+  if (gSubscriptionCount == MAX_SUBSCRIPTIONS) return false;
+  snprintf(gSubscriptions[gSubscriptionCount++], sizeof(gSubscriptions[0]), "%s", topic);
+  return true;
+}
+
+bool PubSubClient::unsubscribe(const char* topic) {
+  for (size_t i = 0; i < gSubscriptionCount; i++) {
+    if (!strcmp(gSubscriptions[i], topic)) {
+      memmove(gSubscriptions[i], gSubscriptions[i + 1], (gSubscriptionCount - i - 1) * sizeof(gSubscriptions[0]));
+      gSubscriptionCount--;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool PubSubClient::loop() {
+  if (!connected()) return false;
+  const char* topic;
+  const char* payload;
+  if (!HostSim::nextBrokerMessage(topic, payload)) return true;
+  if (!subscribed(topic) || !callback_) return true;
+  // The real client hands out pointers into its own packet buffer.
+  static char buffer[1024];
+  size_t tlen = strlen(topic), plen = strlen(payload);
+  if (tlen + plen + 7 > bufferSize_ || tlen + plen + 2 > sizeof(buffer)) return true;
+  memcpy(buffer, topic, tlen + 1);
+  memcpy(buffer + tlen + 1, payload, plen);
+  HostSim::counters().mqttDelivered++;
+  callback_(buffer, (uint8_t*)buffer + tlen + 1, (unsigned int)plen);
+  return true;
+}
@@ -0,0 +1,511 @@
+/* =======================
+   Host simulator core: clock, heap, flash, GPIO and the main() driving
+   setup()/loop() exactly like the ESP8266 core does.
+   ======================= */
+#include "HostSim.h"
+#include "EEPROM.h"
+#include <chrono>
+#include <thread>
+#include <malloc.h>
+#include <unistd.h>
+
+void setup();
+void loop();
+
+EspClass ESP;
+EEPROMClass EEPROM;
+
+namespace HostSim {
+namespace {
+
+constexpr size_t FLASH_SIZE = 1024 * 1024;
+constexpr uint32_t SECTOR_SIZE = 4096;
+constexpr uint32_t EEPROM_SECTOR = 0xFB;  // Same slot as eagle.flash.1m.ld
+
+Knobs gKnobs;
+Counters gCounters;
+// Simulator bookkeeping lives in static storage so it is never charged
+// against the simulated heap.
+uint8_t gFlash[FLASH_SIZE];
+uint32_t gRtc[128];  // RTC user memory: kept across ESP.restart(), lost on a new run (power cycle)
+constexpr size_t QUEUE_DEPTH = 16;
+HttpRequest gHttpQueue[QUEUE_DEPTH];
+size_t gHttpHead = 0, gHttpCount = 0;
+struct BrokerMessage { char topic[128]; char payload[256]; uint64_t queuedUs; };
+BrokerMessage gInbox[QUEUE_DEPTH];
+size_t gInboxHead = 0, gInboxCount = 0;
+BrokerMessage gDelivering;
+char gEtag[40] = "";
+uint64_t gCmdPendingUs = 0;
+uint64_t gOutputUs = 0;  // Last relay change not yet seen on /events
+uint64_t gHttpSent = 0;
+uint64_t gNextApi = 0;
+uint8_t gPins[17];
+char** gArgv = nullptr;
+const std::chrono::steady_clock::time_point gBoot = std::chrono::steady_clock::now();
+
+uint32_t envU32(const char* name, uint32_t def) {
+  const char* v = getenv(name);
+  return (v && *v) ? (uint32_t)strtoul(v, nullptr, 10) : def;
+}
+
+const char* envStr(const char* name, const char* def) {
+  const char* v = getenv(name);
+  return (v && *v) ? v : def;
+}
+
+void loadKnobs() {
+  gKnobs.runMs = envU32("BEDTIME_SIM_RUN_MS", 10000);
+  gKnobs.heapSize = envU32("BEDTIME_SIM_HEAP", 45000);
+  gKnobs.wifiAssocMs = envU32("BEDTIME_SIM_WIFI_ASSOC_MS", 2500);
+  gKnobs.wifiDhcpMs = envU32("BEDTIME_SIM_WIFI_DHCP_MS", 800);
+  if (gKnobs.wifiDhcpMs > gKnobs.wifiAssocMs) gKnobs.wifiDhcpMs = gKnobs.wifiAssocMs;
+  gKnobs.wifiChannel = envU32("BEDTIME_SIM_WIFI_CHANNEL", 6);
+  gKnobs.connectTimeoutMs = envU32("BEDTIME_SIM_CONNECT_TIMEOUT_MS", 5000);
+  gKnobs.brokerRttMs = envU32("BEDTIME_SIM_BROKER_RTT_MS", 20);
+  gKnobs.cmdIntervalMs = envU32("BEDTIME_SIM_CMD_MS", 0);
+  gKnobs.cmdTopic = envStr("BEDTIME_SIM_CMD_TOPIC", "home/switch/control");
+  gKnobs.httpIntervalMs = envU32("BEDTIME_SIM_HTTP_MS", 0);
+  gKnobs.eventSubscribers = envU32("BEDTIME_SIM_EVENTS", 0);
+  gKnobs.apiIntervalMs = envU32("BEDTIME_SIM_API_MS", 0);
+  gKnobs.httpSlowMs = envU32("BEDTIME_SIM_HTTP_SLOW_MS", 0);
+  gKnobs.flashEraseMs = envU32("BEDTIME_SIM_FLASH_ERASE_MS", 30);
+  gKnobs.flashPath = envStr("BEDTIME_SIM_FLASH", nullptr);
+  gKnobs.setupForm = envStr("BEDTIME_SIM_SETUP", nullptr);
+  gKnobs.setupAtMs = envU32("BEDTIME_SIM_SETUP_AT_MS", 1000);
+  gKnobs.fragStartMs = gKnobs.fragEndMs = gKnobs.fragPercent = 0;
+  if (const char* f = getenv("BEDTIME_SIM_HEAP_FRAG")) {
+    unsigned long a = 0, b = 0, pct = 0;
+    if (sscanf(f, "%lu:%lu:%lu", &a, &b, &pct) == 3 && b > a && pct <= 100) {
+      gKnobs.fragStartMs = a;
+      gKnobs.fragEndMs = b;
+      gKnobs.fragPercent = pct;
+    }
+  }
+  gKnobs.outageStartMs = gKnobs.outageEndMs = 0;
+  if (const char* o = getenv("BEDTIME_SIM_BROKER_OUTAGE")) {
+    unsigned long a = 0, b = 0;
+    if (sscanf(o, "%lu:%lu", &a, &b) == 2 && b > a) {
+      gKnobs.outageStartMs = a;
+      gKnobs.outageEndMs = b;
+    }
+  }
+  gKnobs.wifiOutageStartMs = gKnobs.wifiOutageEndMs = 0;
+  if (const char* o = getenv("BEDTIME_SIM_WIFI_OUTAGE")) {
+    unsigned long a = 0, b = 0;
+    if (sscanf(o, "%lu:%lu", &a, &b) == 2 && b > a) {
+      gKnobs.wifiOutageStartMs = a;
+      gKnobs.wifiOutageEndMs = b;
+    }
+  }
+}
+
+void loadFlash() {
+  memset(gRtc, 0xA5, sizeof(gRtc));  // Power-on garbage
+  if (const char* rtc = getenv("BEDTIME_SIM_RTC_IMAGE")) {
+    if (FILE* f = fopen(rtc, "rb")) {
+      size_t n = fread(gRtc, 1, sizeof(gRtc), f);
+      (void)n;
+      fclose(f);
+    }
+    unsetenv("BEDTIME_SIM_RTC_IMAGE");
+  }
+  memset(gFlash, 0xFF, FLASH_SIZE);
+  if (!gKnobs.flashPath) return;
+  if (FILE* f = fopen(gKnobs.flashPath, "rb")) {
+    size_t n = fread(gFlash, 1, FLASH_SIZE, f);
+    (void)n;
+    fclose(f);
+  }
+}
+
+void saveFlash() {
+  if (!gKnobs.flashPath) return;
+  if (FILE* f = fopen(gKnobs.flashPath, "wb")) {
+    fwrite(gFlash, 1, FLASH_SIZE, f);
+    fclose(f);
+  }
+}
+
+void report() {
+  const Counters& c = gCounters;
+  printf("\n=== BedTimeESP host run: %lu ms ===\n", (unsigned long)nowMs());
+  printf("loop      passes=%llu avg=%lluus max=%lluus >1ms=%llu >10ms=%llu >100ms=%llu\n",
+         (unsigned long long)c.loops, (unsigned long long)(c.loops ? c.loopTotalUs / c.loops : 0),
+         (unsigned long long)c.loopMaxUs, (unsigned long long)c.loopOver1ms,
+         (unsigned long long)c.loopOver10ms, (unsigned long long)c.loopOver100ms);
+  printf("heap      allocs=%llu frees=%llu live=%lld peak=%lld free_now=%u\n",
+         (unsigned long long)c.allocs, (unsigned long long)c.frees, (long long)c.heapLive,
+         (long long)c.heapPeak, ESP.getFreeHeap());
+  printf("flash     erases=%llu writes=%llu\n", (unsigned long long)c.flashErases,
+         (unsigned long long)c.flashWrites);
+  printf("wifi      begins=%llu direct=%llu up_at=%llums reup=%llums\n", (unsigned long long)c.wifiBegins, (unsigned long long)c.wifiDirect,
+         (unsigned long long)c.wifiUpMs, (unsigned long long)c.wifiReupMs);
+  printf("mqtt      connects=%llu failed=%llu publishes=%llu bytes=%llu delivered=%llu\n",
+         (unsigned long long)c.mqttConnects, (unsigned long long)c.mqttConnectFails,
+         (unsigned long long)c.mqttPublishes, (unsigned long long)c.mqttPublishBytes,
+         (unsigned long long)c.mqttDelivered);
+  printf("http      requests=%llu connections=%llu done=%llu rejected=%llu not_modified=%llu bytes=%llu segments=%llu\n",
+         (unsigned long long)c.httpRequests, (unsigned long long)c.httpConnections, (unsigned long long)c.httpDone, (unsigned long long)c.httpRejected,
+         (unsigned long long)c.httpNotModified, (unsigned long long)c.httpBytes, (unsigned long long)c.httpSegments);
+  printf("          avg_latency=%lluus max_latency=%lluus\n",
+         (unsigned long long)(c.httpDone ? c.httpLatencyTotalUs / c.httpDone : 0), (unsigned long long)c.httpLatencyMaxUs);
+  printf("events    received=%llu after_change=%llu avg_latency=%lluus max_latency=%lluus\n",
+         (unsigned long long)c.events, (unsigned long long)c.eventsTimed,
+         (unsigned long long)(c.eventsTimed ? c.eventLatencyTotalUs / c.eventsTimed : 0),
+         (unsigned long long)c.eventLatencyMaxUs);
+  printf("commands  sent=%llu applied=%llu avg_latency=%lluus max_latency=%lluus\n",
+         (unsigned long long)c.cmdSent, (unsigned long long)c.cmdApplied,
+         (unsigned long long)(c.cmdApplied ? c.cmdLatencyTotalUs / c.cmdApplied : 0),
+         (unsigned long long)c.cmdLatencyMaxUs);
+  printf("          <10ms=%llu <50ms=%llu <100ms=%llu <250ms=%llu <500ms=%llu more=%llu\n",
+         (unsigned long long)c.cmdLatencyHist[0], (unsigned long long)c.cmdLatencyHist[1],
+         (unsigned long long)c.cmdLatencyHist[2], (unsigned long long)c.cmdLatencyHist[3],
+         (unsigned long long)c.cmdLatencyHist[4], (unsigned long long)c.cmdLatencyHist[5]);
+  reportPower();
+  fflush(stdout);
+}
+
+void queueHttp(const char* method, const char* uri, const char* body) {
+  if (gHttpCount == QUEUE_DEPTH) return;
+  HttpRequest& r = gHttpQueue[(gHttpHead + gHttpCount++) % QUEUE_DEPTH];
+  snprintf(r.method, sizeof(r.method), "%s", method);
+  snprintf(r.uri, sizeof(r.uri), "%s", uri);
+  snprintf(r.body, sizeof(r.body), "%s", body);
+  r.queuedUs = nowUs();
+  snprintf(r.ifNoneMatch, sizeof(r.ifNoneMatch), "%s", strcmp(uri, "/") ? "" : gEtag);
+}
+
+void injectTraffic(uint64_t now, uint64_t& nextCmd, uint64_t& nextHttp) {
+  for (; gKnobs.eventSubscribers; gKnobs.eventSubscribers--) queueHttp("GET", "/events", "");
+  if (gKnobs.setupForm && now >= gKnobs.setupAtMs * 1000ULL) {
+    queueHttp("POST", "/save", gKnobs.setupForm);
+    gKnobs.setupForm = nullptr;
+    unsetenv("BEDTIME_SIM_SETUP");
+  }
+  if (gKnobs.cmdIntervalMs && now >= nextCmd) {
+    nextCmd = now + gKnobs.cmdIntervalMs * 1000ULL;
+    injectBrokerMessage(gKnobs.cmdTopic, (gCounters.cmdSent & 1) ? "{\"command\":\"off\"}" : "{\"command\":\"on\"}");
+    gCounters.cmdSent++;
+    gCmdPendingUs = now;
+  }
+  if (gKnobs.httpIntervalMs && now >= nextHttp) {
+    nextHttp = now + gKnobs.httpIntervalMs * 1000ULL;
+    static const char* const PAGE_LOAD[] = {"/", "/config.json", "/status"};
+    queueHttp("GET", PAGE_LOAD[gHttpSent++ % 3], "");
+  }
+  if (gKnobs.apiIntervalMs && now >= gNextApi) {
+    gNextApi = now + gKnobs.apiIntervalMs * 1000ULL;
+    queueHttp("POST", "/api/relay", "{\"command\":\"toggle\"}");
+  }
+}
+
+}  // namespace
+
+const Knobs& knobs() { return gKnobs; }
+Counters& counters() { return gCounters; }
+
+uint64_t nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - gBoot).count();
+}
+
+uint32_t nowMs() { return (uint32_t)(nowUs() / 1000); }
+
+void sleepUs(uint64_t us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+
+bool brokerUp() {
+  uint32_t t = nowMs();
+  return !(t >= gKnobs.outageStartMs && t < gKnobs.outageEndMs);
+}
+
+uint8_t* flash() { return gFlash; }
+size_t flashSize() { return FLASH_SIZE; }
+uint32_t eepromSector() { return EEPROM_SECTOR; }
+void flashEraseCost() { sleepUs(gKnobs.flashEraseMs * 1000ULL); }
+
+void outputChanged() {
+  gOutputUs = nowUs();
+  if (!gCmdPendingUs) return;
+  uint64_t lat = nowUs() - gCmdPendingUs;
+  gCmdPendingUs = 0;
+  gCounters.cmdApplied++;
+  gCounters.cmdLatencyTotalUs += lat;
+  if (lat > gCounters.cmdLatencyMaxUs) gCounters.cmdLatencyMaxUs = lat;
+  static const uint64_t EDGES_US[] = {10000, 50000, 100000, 250000, 500000};
+  size_t b = 0;
+  while (b < 5 && lat >= EDGES_US[b]) b++;
+  gCounters.cmdLatencyHist[b]++;
+}
+
+bool nextHttpRequest(HttpRequest& out) {
+  if (!gHttpCount || nowUs() < radioReadyUs(gHttpQueue[gHttpHead].queuedUs)) return false;
+  out = gHttpQueue[gHttpHead];
+  gHttpHead = (gHttpHead + 1) % QUEUE_DEPTH;
+  gHttpCount--;
+  gCounters.httpRequests++;
+  return true;
+}
+
+void httpResponseDone(uint64_t startUs, const char* head) {
+  uint64_t lat = nowUs() - startUs;
+  gCounters.httpDone++;
+  gCounters.httpLatencyTotalUs += lat;
+  if (lat > gCounters.httpLatencyMaxUs) gCounters.httpLatencyMaxUs = lat;
+  int code = strncmp(head, "HTTP/1.1 ", 9) ? 0 : atoi(head + 9);
+  if (code == 304) gCounters.httpNotModified++;
+  if (code == 503) gCounters.httpRejected++;
+  if (const char* etag = strstr(head, "\r\nETag: ")) {
+    etag += 8;
+    size_t n = strcspn(etag, "\r");
+    if (n < sizeof(gEtag)) snprintf(gEtag, sizeof(gEtag), "%.*s", (int)n, etag);
+  }
+}
+
+void httpEvent() {
+  gCounters.events++;
+  if (!gOutputUs) return;
+  uint64_t lat = nowUs() - gOutputUs;
+  gOutputUs = 0;
+  gCounters.eventsTimed++;
+  gCounters.eventLatencyTotalUs += lat;
+  if (lat > gCounters.eventLatencyMaxUs) gCounters.eventLatencyMaxUs = lat;
+}
+
+bool nextBrokerMessage(const char*& topic, const char*& payload) {
+  if (!gInboxCount || nowUs() < radioReadyUs(gInbox[gInboxHead].queuedUs)) return false;
+  gDelivering = gInbox[gInboxHead];
+  gInboxHead = (gInboxHead + 1) % QUEUE_DEPTH;
+  gInboxCount--;
+  topic = gDelivering.topic;
+  payload = gDelivering.payload;
+  return true;
+}
+
+void injectBrokerMessage(const char* topic, const char* payload) {
+  if (gInboxCount == QUEUE_DEPTH) return;
+  BrokerMessage& m = gInbox[(gInboxHead + gInboxCount++) % QUEUE_DEPTH];
+  snprintf(m.topic, sizeof(m.topic), "%s", topic);
+  snprintf(m.payload, sizeof(m.payload), "%s", payload);
+  m.queuedUs = nowUs();
+}
+
+void dropBrokerSession() { gInboxCount = 0; }
+
+}  // namespace HostSim
+
+/* =======================
+   Heap accounting (glibc): every allocation, including ArduinoJson and
+   String, is charged against the simulated ESP heap.
+   ======================= */
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void __libc_free(void*);
+
+static void chargeHeap(int64_t delta) {
+  HostSim::Counters& c = HostSim::counters();
+  c.heapLive += delta;
+  if (c.heapLive > c.heapPeak) c.heapPeak = c.heapLive;
+}
+
+void* malloc(size_t n) {
+  void* p = __libc_malloc(n);
+  if (p) { HostSim::counters().allocs++; chargeHeap(malloc_usable_size(p)); }
+  return p;
+}
+
+void* calloc(size_t n, size_t size) {
+  void* p = __libc_calloc(n, size);
+  if (p) { HostSim::counters().allocs++; chargeHeap(malloc_usable_size(p)); }
+  return p;
+}
+
+void* realloc(void* old, size_t n) {
+  int64_t before = old ? (int64_t)malloc_usable_size(old) : 0;
+  void* p = __libc_realloc(old, n);
+  if (p) { HostSim::counters().allocs++; chargeHeap((int64_t)malloc_usable_size(p) - before); }
+  return p;
+}
+
+void free(void* p) {
+  if (!p) return;
+  HostSim::counters().frees++;
+  chargeHeap(-(int64_t)malloc_usable_size(p));
+  __libc_free(p);
+}
+}
+#endif
+
+/* =======================
+   Arduino core stand-ins
+   ======================= */
+unsigned long millis() { return HostSim::nowMs(); }
+unsigned long micros() { return (unsigned long)HostSim::nowUs(); }
+void delay(unsigned long ms) {
+  HostSim::sleepUs(ms * 1000ULL);
+  HostSim::chargePower(ms * 1000ULL, true);
+  HostSim::pumpNetwork();
+}
+void delayMicroseconds(unsigned int us) { HostSim::sleepUs(us); }
+void yield() { HostSim::pumpNetwork(); }
+
+void pinMode(uint8_t, uint8_t) {}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if (pin >= sizeof(HostSim::gPins)) return;
+  if (HostSim::gPins[pin] != val) HostSim::outputChanged();
+  HostSim::gPins[pin] = val;
+}
+
+HostGpioReg GPOS = {HIGH}, GPOC = {LOW};
+
+HostGpioReg& HostGpioReg::operator=(uint32_t bits) {
+  bool changed = false;
+  for (uint8_t pin = 0; pin < 16; pin++) {
+    if (!(bits & (1UL << pin)) || HostSim::gPins[pin] == level) continue;
+    HostSim::gPins[pin] = level;
+    changed = true;
+  }
+  if (changed) HostSim::outputChanged();  // One store switches every pin
+  return *this;
+}
+
+int digitalRead(uint8_t pin) { return pin < sizeof(HostSim::gPins) ? HostSim::gPins[pin] : LOW; }
+
+long random(long howbig) { return howbig ? (long)(::random() % howbig) : 0; }
+long random(long howsmall, long howbig) { return howbig > howsmall ? howsmall + random(howbig - howsmall) : howsmall; }
+void randomSeed(unsigned long seed) { srandom((unsigned)seed); }
+
+uint32_t EspClass::getFreeHeap() {
+  int64_t free = (int64_t)HostSim::knobs().heapSize - HostSim::counters().heapLive;
+  if (free < 0) return 0;
+  return free > HostSim::knobs().heapSize ? HostSim::knobs().heapSize : (uint32_t)free;
+}
+
+// Fragmentation is injected: the largest block shrinks by the same share.
+uint32_t EspClass::getMaxFreeBlockSize() { return (uint64_t)getFreeHeap() * (100 - getHeapFragmentation()) / 100; }
+
+uint8_t EspClass::getHeapFragmentation() {
+  const HostSim::Knobs& k = HostSim::knobs();
+  uint32_t t = HostSim::nowMs();
+  return (t >= k.fragStartMs && t < k.fragEndMs) ? k.fragPercent : 0;
+}
+uint32_t EspClass::getChipId() { return 0x00C0FFEE & 0xFFFFFF; }
+uint32_t EspClass::getCycleCount() { return (uint32_t)(HostSim::nowUs() * (F_CPU / 1000000L)); }
+
+bool EspClass::flashEraseSector(uint32_t sector) {
+  if ((sector + 1) * HostSim::SECTOR_SIZE > HostSim::FLASH_SIZE) return false;
+  memset(HostSim::gFlash + sector * HostSim::SECTOR_SIZE, 0xFF, HostSim::SECTOR_SIZE);
+  HostSim::counters().flashErases++;
+  HostSim::flashEraseCost();
+  return true;
+}
+
+bool EspClass::flashWrite(uint32_t address, const uint32_t* data, size_t size) {
+  if ((address & 3) || (size & 3) || address + size > HostSim::FLASH_SIZE) return false;
+  const uint8_t* src = (const uint8_t*)data;
+  for (size_t i = 0; i < size; i++) HostSim::gFlash[address + i] &= src[i];  // NOR: bits only clear
+  HostSim::counters().flashWrites++;
+  return true;
+}
+
+bool EspClass::flashRead(uint32_t address, uint32_t* data, size_t size) {
+  if (address + size > HostSim::FLASH_SIZE) return false;
+  memcpy(data, HostSim::gFlash + address, size);
+  return true;
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size) {
+  if (offset * 4 + size > sizeof(HostSim::gRtc) || size % 4) return false;
+  memcpy(data, HostSim::gRtc + offset, size);
+  return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size) {
+  if (offset * 4 + size > sizeof(HostSim::gRtc) || size % 4) return false;
+  memcpy(HostSim::gRtc + offset, data, size);
+  return true;
+}
+
+void EspClass::restart() {
+  HostSim::report();
+  HostSim::saveFlash();
+  if (!HostSim::gKnobs.flashPath) {
+    static char path[64];
+    snprintf(path, sizeof(path), "/tmp/bedtime-sim-%d.bin", (int)getpid());
+    setenv("BEDTIME_SIM_FLASH", path, 1);
+    HostSim::gKnobs.flashPath = path;
+    HostSim::saveFlash();
+  }
+  static char rtcPath[80];
+  snprintf(rtcPath, sizeof(rtcPath), "%s.rtc", HostSim::gKnobs.flashPath);
+  if (FILE* f = fopen(rtcPath, "wb")) {
+    fwrite(HostSim::gRtc, 1, sizeof(HostSim::gRtc), f);
+    fclose(f);
+    setenv("BEDTIME_SIM_RTC_IMAGE", rtcPath, 1);
+  }
+  printf("--- ESP.restart() ---\n");
+  fflush(stdout);
+  execv("/proc/self/exe", HostSim::gArgv);
+  exit(1);
+}
+
+void EEPROMClass::begin(size_t size) {
+  size_ = size > sizeof(data_) ? sizeof(data_) : size;
+  memcpy(data_, HostSim::flash() + HostSim::eepromSector() * HostSim::SECTOR_SIZE, size_);
+  dirty_ = false;
+}
+
+bool EEPROMClass::commit() {
+  if (!size_ || !dirty_) return true;
+  uint32_t sector = HostSim::eepromSector();
+  ESP.flashEraseSector(sector);
+  uint32_t buf[sizeof(data_) / 4];
+  memcpy(buf, data_, size_);
+  ESP.flashWrite(sector * HostSim::SECTOR_SIZE, buf, (size_ + 3) & ~3u);
+  dirty_ = false;
+  return true;
+}
+
+bool EEPROMClass::end() {
+  bool ok = commit();
+  size_ = 0;
+  return ok;
+}
+
+/* =======================
+   Simulation driver
+   ======================= */
+int main(int, char** argv) {
+  using namespace HostSim;
+  gArgv = argv;
+  static char stdoutBuf[4096];
+  setvbuf(stdout, stdoutBuf, _IOLBF, sizeof(stdoutBuf));
+  loadKnobs();
+  loadFlash();
+  gCounters = Counters();  // Drop libstdc++/stdio start-up allocations
+  setup();
+  uint64_t nextCmd = 0, nextHttp = 0;
+  const uint64_t runUs = gKnobs.runMs * 1000ULL;
+  while (nowUs() < runUs) {
+    uint64_t t0 = nowUs(), idle0 = gCounters.idleUs;
+    injectTraffic(t0, nextCmd, nextHttp);
+    pumpNetwork();
+    loop();
+    uint64_t dt = nowUs() - t0;
+    Counters& c = gCounters;
+    uint64_t idle = c.idleUs - idle0;
+    chargePower(dt > idle ? dt - idle : 0, false);
+    c.loops++;
+    c.loopTotalUs += dt;
+    if (dt > c.loopMaxUs) c.loopMaxUs = dt;
+    if (dt > 1000) c.loopOver1ms++;
+    if (dt > 10000) c.loopOver10ms++;
+    if (dt > 100000) c.loopOver100ms++;
+  }
+  report();
+  saveFlash();
+  return 0;
+}
@@ -0,0 +1,95 @@
+#pragma once
+/* =======================
+   Host simulator shared state (env:native only)
+   ======================= */
+#include "Arduino.h"
+
+namespace HostSim {
+
+// All knobs come from BEDTIME_SIM_* environment variables, see README.
+struct Knobs {
+  uint32_t runMs;             // BEDTIME_SIM_RUN_MS: how long to run loop()
+  uint32_t heapSize;          // BEDTIME_SIM_HEAP: heap reported free at boot
+  uint32_t fragStartMs;       // BEDTIME_SIM_HEAP_FRAG=start:end:percent (ms since boot)
+  uint32_t fragEndMs;
+  uint8_t fragPercent;
+  uint32_t wifiAssocMs;       // BEDTIME_SIM_WIFI_ASSOC_MS: scan + join + DHCP time
+  uint32_t wifiDhcpMs;        // BEDTIME_SIM_WIFI_DHCP_MS: the DHCP part of it
+  uint8_t wifiChannel;        // BEDTIME_SIM_WIFI_CHANNEL: the AP's channel
+  uint32_t connectTimeoutMs;  // BEDTIME_SIM_CONNECT_TIMEOUT_MS: TCP connect timeout to a dead broker
+  uint32_t brokerRttMs;       // BEDTIME_SIM_BROKER_RTT_MS: CONNECT -> CONNACK round trip
+  uint32_t outageStartMs;     // BEDTIME_SIM_BROKER_OUTAGE=start:end (ms since boot)
+  uint32_t outageEndMs;
+  uint32_t wifiOutageStartMs; // BEDTIME_SIM_WIFI_OUTAGE=start:end (ms since boot), AP gone
+  uint32_t wifiOutageEndMs;
+  uint32_t cmdIntervalMs;     // BEDTIME_SIM_CMD_MS: alternate on/off commands, 0 = off
+  const char* cmdTopic;       // BEDTIME_SIM_CMD_TOPIC
+  uint32_t httpIntervalMs;    // BEDTIME_SIM_HTTP_MS: cycle GET /, /config.json, /status, 0 = off
+  uint32_t eventSubscribers;  // BEDTIME_SIM_EVENTS: browsers holding /events open
+  uint32_t apiIntervalMs;     // BEDTIME_SIM_API_MS: POST a toggle to /api/relay, 0 = off
+  uint32_t httpSlowMs;        // BEDTIME_SIM_HTTP_SLOW_MS: gap between 16-byte request segments, 0 = one segment
+  uint32_t flashEraseMs;      // BEDTIME_SIM_FLASH_ERASE_MS: sector erase cost
+  const char* flashPath;      // BEDTIME_SIM_FLASH: flash image persisted across runs/restarts
+  const char* setupForm;      // BEDTIME_SIM_SETUP: urlencoded form POSTed to /save on first boot
+  uint32_t setupAtMs;         // BEDTIME_SIM_SETUP_AT_MS: when to POST it
+};
+
+struct Counters {
+  uint64_t loops, loopTotalUs, loopMaxUs;
+  uint64_t loopOver1ms, loopOver10ms, loopOver100ms;
+  uint64_t allocs, frees;
+  int64_t heapLive, heapPeak;
+  uint64_t flashErases, flashWrites;
+  uint64_t wifiBegins, wifiUpMs;  // WiFi.begin() calls; first association, ms since boot
+  uint64_t wifiDirect, wifiReupMs; // begin() with channel/BSSID; WIFI_OUTAGE end -> associated again
+  uint64_t mqttConnects, mqttConnectFails, mqttPublishes, mqttPublishBytes, mqttDelivered;
+  uint64_t httpRequests, httpConnections, httpBytes, httpSegments, httpNotModified;
+  uint64_t httpDone, httpRejected, httpLatencyTotalUs, httpLatencyMaxUs;
+  uint64_t events, eventsTimed, eventLatencyTotalUs, eventLatencyMaxUs;
+  uint64_t cmdSent, cmdApplied, cmdLatencyTotalUs, cmdLatencyMaxUs;
+  uint64_t cmdLatencyHist[6];  // <10, <50, <100, <250, <500 ms, more
+  uint64_t sleepUs, idleUs, chargeUaUs;  // Radio asleep, loop() in delay(), modelled charge
+};
+
+const Knobs& knobs();
+Counters& counters();
+uint64_t nowUs();
+uint32_t nowMs();
+void sleepUs(uint64_t us);
+bool brokerUp();
+
+uint8_t* flash();
+size_t flashSize();
+uint32_t eepromSector();
+void flashEraseCost();
+
+void outputChanged();
+
+// Radio power save (HostNet.cpp). While the station sleeps, traffic for it
+// waits at the AP for the next beacon-aligned wake-up.
+uint64_t radioReadyUs(uint64_t arrivalUs);
+void chargePower(uint64_t us, bool idle);
+void reportPower();
+
+struct HttpRequest {
+  char method[8];
+  char uri[96];
+  char body[384];
+  char ifNoneMatch[40];
+  uint64_t queuedUs;
+};
+bool nextHttpRequest(HttpRequest& out);
+// The simulated browser keeps the last ETag and revalidates GET / with it.
+// `head` is the start of the response, for its status line and ETag.
+void httpResponseDone(uint64_t startUs, const char* head);
+// One server-sent event received; the first after a relay change is timed.
+void httpEvent();
+
+// Stands in for the SYS task: delivers async TCP and DNS events.
+void pumpNetwork();
+
+bool nextBrokerMessage(const char*& topic, const char*& payload);
+void injectBrokerMessage(const char* topic, const char* payload);
+void dropBrokerSession();
+
+}  // namespace HostSim
@@ -0,0 +1,47 @@
+#pragma once
+#include "Arduino.h"
+#include "Client.h"
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST -3
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+
+// Same surface as knolleary/PubSubClient 2.8, talking to the simulated broker.
+class PubSubClient {
+ public:
+  explicit PubSubClient(Client& client) : client_(&client) {}
+  PubSubClient& setServer(IPAddress ip, uint16_t port);
+  PubSubClient& setServer(const char* domain, uint16_t port);
+  PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE) { callback_ = callback; return *this; }
+  PubSubClient& setClient(Client& client) { client_ = &client; return *this; }
+  PubSubClient& setKeepAlive(uint16_t keepAlive) { keepAlive_ = keepAlive; return *this; }
+  PubSubClient& setSocketTimeout(uint16_t timeout) { socketTimeout_ = timeout; return *this; }
+  bool setBufferSize(uint16_t size);
+  uint16_t getBufferSize() const { return bufferSize_; }
+  bool connect(const char* id) { return connect(id, nullptr, nullptr, nullptr, 0, false, nullptr); }
+  bool connect(const char* id, const char* user, const char* pass) { return connect(id, user, pass, nullptr, 0, false, nullptr); }
+  bool connect(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage, bool cleanSession = true);
+  void disconnect();
+  bool publish(const char* topic, const char* payload) { return publish(topic, payload, false); }
+  bool publish(const char* topic, const char* payload, bool retained);
+  bool publish(const char* topic, const uint8_t* payload, unsigned int plength, bool retained);
+  bool subscribe(const char* topic, uint8_t qos = 0);
+  bool unsubscribe(const char* topic);
+  bool loop();
+  bool connected();
+  int state() const { return state_; }
+
+ private:
+  Client* client_;
+  std::function<void(char*, uint8_t*, unsigned int)> callback_;
+  char domain_[64] = "";
+  uint16_t port_ = 1883;
+  uint16_t keepAlive_ = 15;
+  uint16_t socketTimeout_ = 15;
+  uint16_t bufferSize_ = 256;
+  int state_ = MQTT_DISCONNECTED;
+};
@@ -0,0 +1,5 @@
+#pragma once
+// Simulated flash follows eagle.flash.1m64.ld: 64 KB FS below the EEPROM sector.
+#define FLASH_SECTOR_SIZE 0x1000
+#define FS_PHYS_ADDR 0xEB000
+#define FS_PHYS_SIZE 0x10000
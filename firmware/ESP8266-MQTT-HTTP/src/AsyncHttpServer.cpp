@@ -0,0 +1,435 @@
+#include "AsyncHttpServer.h"
+
+namespace {
+
+const char STREAM_HEAD[] = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n";
+const char BUSY_RESPONSE[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+const char* statusText(int code) {
+  switch (code) {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 413: return "Payload Too Large";
+    case 414: return "URI Too Long";
+    case 431: return "Request Header Fields Too Large";
+    case 503: return "Service Unavailable";
+    default: return "Internal Server Error";
+  }
+}
+
+int hexVal(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+bool headerIs(const char* line, const char* name, const char*& value) {
+  size_t n = strlen(name);
+  if (strncasecmp(line, name, n) || line[n] != ':') return false;
+  value = line + n + 1;
+  while (*value == ' ' || *value == '\t') value++;
+  return true;
+}
+
+}  // namespace
+
+/* =======================
+   Request parsing (lwIP callbacks)
+   ======================= */
+void AsyncHttpRequest::open(AsyncClient* c) {
+  client_ = c;
+  served_ = 0;
+  reset();
+  c->setNoDelay(true);
+  c->onData(onData, this);
+  c->onAck(onAck, this);
+  c->onDisconnect(onDisconnect, this);
+}
+
+// Ready for the next request on the same connection.
+void AsyncHttpRequest::reset() {
+  state_ = RECV_HEAD;
+  method_ = HTTP_OTHER;
+  chunked_ = started_ = done_ = keepAlive_ = false;
+  error_ = 0;
+  len_ = sent_ = bodyLen_ = 0;
+  tail_ = nullptr;
+  tailLen_ = 0;
+  uri_[0] = query_[0] = etag_[0] = buf_[0] = '\0';
+  since_ = millis();
+}
+
+// Hands the connection back for closing; its callbacks no longer reach us.
+AsyncClient* AsyncHttpRequest::detach() {
+  AsyncClient* c = client_;
+  client_ = nullptr;
+  state_ = FREE;
+  c->onData(nullptr);
+  c->onAck(nullptr);
+  c->onDisconnect([](void*, AsyncClient* c) { delete c; });
+  return c;
+}
+
+void AsyncHttpRequest::fail(int code) {
+  error_ = code;
+  keepAlive_ = false; // Framing is lost; close after the error
+  state_ = READY;
+}
+
+void AsyncHttpRequest::feed(const char* data, size_t len) {
+  if (state_ != RECV_HEAD && state_ != RECV_BODY) {
+    keepAlive_ = false; // No pipelining: close after this response so the client retries
+    return;
+  }
+  size_t i = 0;
+  for (; i < len && (state_ == RECV_HEAD || state_ == RECV_BODY); i++) {
+    if (len_ == sizeof(buf_) - 1) return fail(state_ == RECV_HEAD ? 431 : 413);
+    buf_[len_++] = data[i];
+    if (state_ == RECV_BODY) {
+      if (len_ < bodyLen_) continue;
+      buf_[len_] = '\0';
+      state_ = READY;
+    } else if (data[i] == '\n') {
+      buf_[--len_] = '\0';
+      if (len_ && buf_[len_ - 1] == '\r') buf_[--len_] = '\0';
+      if (len_) headerLine(buf_);
+      else if (uri_[0]) state_ = bodyLen_ ? RECV_BODY : READY; // Blank line ends the head
+      len_ = 0;
+      buf_[0] = '\0';
+    }
+  }
+  if (i < len) keepAlive_ = false; // Pipelined request in the same segment: dropped, so close after this one
+}
+
+void AsyncHttpRequest::headerLine(char* line) {
+  if (!uri_[0]) { // Request line: METHOD SP target SP version
+    char* target = strchr(line, ' ');
+    char* end = target ? strchr(target + 1, ' ') : nullptr;
+    if (!end || target[1] != '/') return fail(400);
+    *target++ = '\0';
+    *end = '\0';
+    keepAlive_ = !strcmp(end + 1, "HTTP/1.1");
+    method_ = !strcmp(line, "GET") ? HTTP_GET : !strcmp(line, "POST") ? HTTP_POST : HTTP_OTHER;
+    char* query = strchr(target, '?');
+    if (query) *query++ = '\0';
+    if (strlen(target) >= sizeof(uri_) || (query && strlen(query) >= sizeof(query_))) return fail(414);
+    strcpy(uri_, target);
+    strcpy(query_, query ? query : "");
+    return;
+  }
+  const char* value;
+  if (headerIs(line, "Content-Length", value)) {
+    long n = atol(value);
+    if (n < 0 || n >= (long)sizeof(buf_)) return fail(413);
+    bodyLen_ = n;
+  } else if (headerIs(line, "Connection", value)) {
+    if (!strncasecmp(value, "close", 5)) keepAlive_ = false;
+    else if (!strncasecmp(value, "keep-alive", 10)) keepAlive_ = true;
+  } else if (headerIs(line, "If-None-Match", value)) {
+    strncpy(etag_, value, sizeof(etag_) - 1);
+    etag_[sizeof(etag_) - 1] = '\0';
+  }
+}
+
+void AsyncHttpRequest::onData(void* arg, AsyncClient*, void* data, size_t len) {
+  static_cast<AsyncHttpRequest*>(arg)->feed((const char*)data, len);
+}
+
+void AsyncHttpRequest::onAck(void* arg, AsyncClient*, size_t, uint32_t) {
+  static_cast<AsyncHttpRequest*>(arg)->pump();
+}
+
+void AsyncHttpRequest::onDisconnect(void* arg, AsyncClient* c) {
+  AsyncHttpRequest* r = static_cast<AsyncHttpRequest*>(arg);
+  if (r->client_ == c) {
+    r->client_ = nullptr;
+    if (r->state_ != HANDLING) r->state_ = FREE; // poll() frees it after the handler
+  }
+  delete c;
+}
+
+/* =======================
+   Arguments (query string, then urlencoded POST body)
+   ======================= */
+const char* AsyncHttpRequest::findArg(const char* src, const char* name, size_t& len) const {
+  size_t n = strlen(name);
+  while (*src) {
+    const char* amp = strchr(src, '&');
+    size_t pair = amp ? (size_t)(amp - src) : strlen(src);
+    if (pair >= n && !strncmp(src, name, n) && (pair == n || src[n] == '=')) {
+      len = pair == n ? 0 : pair - n - 1;
+      return src + (pair == n ? n : n + 1);
+    }
+    if (!amp) break;
+    src = amp + 1;
+  }
+  return nullptr;
+}
+
+bool AsyncHttpRequest::hasArg(const char* name) const {
+  size_t len;
+  return findArg(query_, name, len) || (method_ == HTTP_POST && findArg(buf_, name, len));
+}
+
+bool AsyncHttpRequest::arg(const char* name, char* out, size_t size) const {
+  size_t len;
+  const char* v = findArg(query_, name, len);
+  if (!v && method_ == HTTP_POST) v = findArg(buf_, name, len);
+  if (!v || !size) return false;
+  size_t o = 0;
+  for (size_t i = 0; i < len && o + 1 < size; i++) {
+    char c = v[i];
+    if (c == '+') {
+      c = ' ';
+    } else if (c == '%' && i + 2 < len && hexVal(v[i + 1]) >= 0 && hexVal(v[i + 2]) >= 0) {
+      c = (char)(hexVal(v[i + 1]) * 16 + hexVal(v[i + 2]));
+      i += 2;
+    }
+    out[o++] = c;
+  }
+  out[o] = '\0';
+  return true;
+}
+
+/* =======================
+   Response
+   ======================= */
+// Bytes go straight into the TCP window when nothing is queued ahead of
+// them; the rest waits in buf_ for the next ack. A response that outgrows
+// the window and the slot is not cut short behind its Content-Length: the
+// connection is reset, so the client sees a failed request, not a short
+// body. Larger bodies go through send_P() or ChunkWriter.
+void AsyncHttpRequest::queue(const char* data, size_t n) {
+  if (!client_) return;
+  if (sent_ == len_) {
+    len_ = sent_ = 0;
+    size_t room = client_->space();
+    size_t took = client_->add(data, n < room ? n : room);
+    data += took;
+    n -= took;
+  }
+  if (!n) return;
+  if (sent_) {
+    memmove(buf_, buf_ + sent_, len_ - sent_);
+    len_ -= sent_;
+    sent_ = 0;
+  }
+  if (n > sizeof(buf_) - len_) {
+    detach()->close(true);
+    return;
+  }
+  memcpy(buf_ + len_, data, n);
+  len_ += n;
+}
+
+void AsyncHttpRequest::pump() {
+  AsyncClient* c = client_;
+  if (!c || (state_ != HANDLING && state_ != SENDING && state_ != STREAM)) return;
+  while (sent_ < len_) {
+    size_t room = c->space();
+    size_t took = c->add(buf_ + sent_, (size_t)(len_ - sent_) < room ? len_ - sent_ : room);
+    if (!took) break;
+    sent_ += took;
+  }
+  while (sent_ == len_ && tailLen_) {
+    char tmp[128];
+    size_t n = tailLen_ < sizeof(tmp) ? tailLen_ : sizeof(tmp);
+    if (n > c->space()) n = c->space();
+    if (!n) break;
+    memcpy_P(tmp, tail_, n);
+    size_t took = c->add(tmp, n);
+    if (!took) break;
+    tail_ += took;
+    tailLen_ -= took;
+  }
+  c->send();
+  if (!done_ || sent_ != len_ || tailLen_) return;
+  served_++;
+  if (keepAlive_) reset();
+  else c->close(); // FIN follows the queued data
+}
+
+void AsyncHttpRequest::beginResponse(int code, const char* type, size_t len, const char* headers) {
+  if (state_ != HANDLING) return;
+  len_ = sent_ = 0;
+  tail_ = nullptr;
+  tailLen_ = 0;
+  started_ = true;
+  done_ = false;
+  chunked_ = len == HTTP_CHUNKED;
+  char length[40] = "";
+  if (chunked_) strcpy(length, "Transfer-Encoding: chunked\r\n");
+  else if (code != 304) snprintf(length, sizeof(length), "Content-Length: %u\r\n", (unsigned)len);
+  char head[256];
+  int n = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\n%s%s%s%s%sConnection: %s\r\n\r\n", code, statusText(code),
+                   type ? "Content-Type: " : "", type ? type : "", type ? "\r\n" : "", length, headers ? headers : "",
+                   keepAlive_ ? "keep-alive" : "close");
+  queue(head, n < (int)sizeof(head) ? n : sizeof(head) - 1);
+}
+
+void AsyncHttpRequest::write(const char* data, size_t len) {
+  if (state_ != HANDLING || !len) return;
+  if (chunked_) {
+    char size[12];
+    queue(size, snprintf(size, sizeof(size), "%x\r\n", (unsigned)len));
+    queue(data, len);
+    queue("\r\n", 2);
+  } else {
+    queue(data, len);
+  }
+  pump();
+}
+
+void AsyncHttpRequest::end() {
+  if (state_ != HANDLING) return;
+  if (chunked_) queue("0\r\n\r\n", 5);
+  done_ = true;
+  pump();
+}
+
+void AsyncHttpRequest::send(int code, const char* type, const char* body, size_t len, const char* headers) {
+  beginResponse(code, type, len, headers);
+  write(body, len);
+  end();
+}
+
+void AsyncHttpRequest::send_P(int code, const char* type, PGM_P body, size_t len, const char* headers) {
+  beginResponse(code, type, len, headers);
+  tail_ = body;
+  tailLen_ = len;
+  end();
+}
+
+// The backlog check keeps a partial event from ever being queued: a
+// subscriber that cannot take a whole one is closed, and reconnects.
+bool AsyncHttpRequest::event(const char* name, const char* data, size_t len) {
+  if (state_ != STREAM || !client_) return false;
+  size_t need = 7 + strlen(name) + 7 + len + 2; // "event: " name "\ndata: " data "\n\n"
+  if (len_ - sent_ + need > sizeof(buf_)) {
+    client_->close(true);
+    return false;
+  }
+  queue("event: ", 7);
+  queue(name, strlen(name));
+  queue("\ndata: ", 7);
+  queue(data, len);
+  queue("\n\n", 2);
+  pump();
+  since_ = millis();
+  return true;
+}
+
+/* =======================
+   Server
+   ======================= */
+bool AsyncHttpServer::on(const char* path, HttpMethod method, HttpHandler fn) {
+  if (routeCount_ == HTTP_MAX_ROUTES) return false;
+  routes_[routeCount_++] = {path, method, fn};
+  return true;
+}
+
+void AsyncHttpServer::begin() {
+  server_.onClient(onClient, this);
+  server_.setNoDelay(true);
+  server_.begin();
+}
+
+void AsyncHttpServer::onClient(void* arg, AsyncClient* c) {
+  AsyncHttpServer* self = static_cast<AsyncHttpServer*>(arg);
+  if (!self->accepting_) return self->reject(c);
+  AsyncHttpRequest* idle = nullptr;
+  for (AsyncHttpRequest& r : self->slots_) {
+    if (r.state_ == AsyncHttpRequest::FREE) {
+      r.open(c);
+      return;
+    }
+    if (r.served_ && r.idle() && (!idle || millis() - r.since_ > millis() - idle->since_)) idle = &r; // Longest idle
+  }
+  if (idle) {
+    idle->detach()->close(true);
+    idle->open(c);
+    return;
+  }
+  self->reject(c);
+}
+
+void AsyncHttpServer::reject(AsyncClient* c) {
+  rejected_++;
+  c->onDisconnect([](void*, AsyncClient* c) { delete c; });
+  c->add(BUSY_RESPONSE, sizeof(BUSY_RESPONSE) - 1);
+  c->send();
+  c->close();
+}
+
+void AsyncHttpServer::dispatch(AsyncHttpRequest& req) {
+  for (uint8_t i = 0; i < routeCount_; i++) {
+    const Route& rt = routes_[i];
+    if (strcmp(rt.path, req.uri_) || (rt.method != HTTP_ANY && rt.method != req.method_)) continue;
+    rt.fn(req);
+    return;
+  }
+  if (notFound_) notFound_(req);
+  else req.send(404, "text/plain", "Not found");
+}
+
+bool AsyncHttpServer::subscribe(AsyncHttpRequest& req) {
+  if (req.state_ != AsyncHttpRequest::HANDLING || subscribers() >= HTTP_MAX_STREAMS) return false;
+  req.keepAlive_ = false;
+  req.started_ = true;
+  req.state_ = AsyncHttpRequest::STREAM;
+  req.since_ = millis();
+  req.queue(STREAM_HEAD, sizeof(STREAM_HEAD) - 1);
+  req.pump();
+  return true;
+}
+
+void AsyncHttpServer::broadcast(const char* name, const char* data, size_t len) {
+  for (AsyncHttpRequest& r : slots_) r.event(name, data, len);
+}
+
+void AsyncHttpServer::poll() {
+  for (AsyncHttpRequest& r : slots_) {
+    if (r.state_ == AsyncHttpRequest::STREAM && r.client_ && millis() - r.since_ > HTTP_STREAM_HEARTBEAT) {
+      if (r.sent_ != r.len_) r.client_->close(true); // Backlog not drained in a whole period
+      else {
+        r.since_ = millis();
+        r.queue(":\n\n", 3);
+        r.pump();
+      }
+      continue;
+    }
+    bool receiving = r.state_ == AsyncHttpRequest::RECV_HEAD || r.state_ == AsyncHttpRequest::RECV_BODY;
+    if (r.idle() && r.served_) {
+      if (millis() - r.since_ > HTTP_KEEPALIVE_TIMEOUT) r.detach()->close();
+      continue;
+    }
+    if (receiving && millis() - r.since_ > HTTP_REQUEST_TIMEOUT) r.fail(408);
+    if (r.state_ == AsyncHttpRequest::SENDING && r.client_ && millis() - r.since_ > 4 * HTTP_REQUEST_TIMEOUT) r.client_->close(true);
+    if (r.state_ != AsyncHttpRequest::READY) continue;
+    r.state_ = AsyncHttpRequest::HANDLING;
+    if (r.error_) r.send(r.error_, "text/plain", "", 0);
+    else dispatch(r);
+    if (r.state_ != AsyncHttpRequest::HANDLING) continue; // Already waiting for the next request
+    if (r.client_ && !r.started_) r.send(500, "text/plain", "No response");
+    else if (r.client_ && !r.done_) r.end();
+    if (r.state_ == AsyncHttpRequest::HANDLING) r.state_ = r.client_ ? AsyncHttpRequest::SENDING : AsyncHttpRequest::FREE;
+  }
+}
+
+uint8_t AsyncHttpServer::active() const {
+  uint8_t n = 0;
+  for (const AsyncHttpRequest& r : slots_) n += r.state_ != AsyncHttpRequest::FREE;
+  return n;
+}
+
+uint8_t AsyncHttpServer::subscribers() const {
+  uint8_t n = 0;
+  for (const AsyncHttpRequest& r : slots_) n += r.state_ == AsyncHttpRequest::STREAM;
+  return n;
+}
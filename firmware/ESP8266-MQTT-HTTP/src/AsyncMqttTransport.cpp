@@ -0,0 +1,63 @@
+#include "AsyncMqttTransport.h"
+
+AsyncMqttTransport::AsyncMqttTransport() {
+  client_.setNoDelay(true);
+  client_.onData([](void* arg, AsyncClient*, void* data, size_t len) {
+    static_cast<AsyncMqttTransport*>(arg)->onData((const uint8_t*)data, len);
+  }, this);
+  client_.onError([](void* arg, AsyncClient*, err_t) {
+    static_cast<AsyncMqttTransport*>(arg)->failed_ = true;
+  }, this);
+  client_.onDisconnect([](void* arg, AsyncClient*) {
+    static_cast<AsyncMqttTransport*>(arg)->failed_ = true;
+  }, this);
+}
+
+bool AsyncMqttTransport::begin(IPAddress ip, uint16_t port) {
+  stop();
+  failed_ = false;
+  return client_.connect(ip, port);
+}
+
+void AsyncMqttTransport::onData(const uint8_t* data, size_t len) {
+  if (len > MQTT_RX_RING - rxCount_) {
+    // PubSubClient could not buffer a packet this large anyway.
+    client_.close(true);
+    return;
+  }
+  for (size_t i = 0; i < len; i++) rx_[(rxHead_ + rxCount_ + i) % MQTT_RX_RING] = data[i];
+  rxCount_ += len;
+}
+
+size_t AsyncMqttTransport::write(const uint8_t* buf, size_t size) {
+  if (!client_.connected() || client_.space() < size) return 0;
+  size_t n = client_.add((const char*)buf, size);
+  client_.send();
+  return n;
+}
+
+int AsyncMqttTransport::available() {
+  if (!rxCount_) yield(); // Lets lwIP deliver while PubSubClient waits for CONNACK
+  return rxCount_;
+}
+
+int AsyncMqttTransport::read() {
+  if (!rxCount_) return -1;
+  uint8_t b = rx_[rxHead_];
+  rxHead_ = (rxHead_ + 1) % MQTT_RX_RING;
+  rxCount_--;
+  return b;
+}
+
+int AsyncMqttTransport::read(uint8_t* buf, size_t size) {
+  size_t n = 0;
+  while (n < size && rxCount_) buf[n++] = read();
+  return n;
+}
+
+int AsyncMqttTransport::peek() { return rxCount_ ? rx_[rxHead_] : -1; }
+
+void AsyncMqttTransport::stop() {
+  if (!client_.disconnected()) client_.close(true);
+  rxHead_ = rxCount_ = 0;
+}
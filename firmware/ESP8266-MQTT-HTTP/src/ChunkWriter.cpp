@@ -0,0 +1,56 @@
+#include "ChunkWriter.h"
+
+void ChunkWriter::spill() {
+  flush_(buf_, len_, total_ == 0, false);
+  total_ += len_;
+  len_ = 0;
+}
+
+ChunkWriter& ChunkWriter::write(const char* s, size_t n) {
+  while (n) {
+    if (len_ == size_) spill();
+    size_t take = size_ - len_ < n ? size_ - len_ : n;
+    memcpy(buf_ + len_, s, take);
+    len_ += take;
+    s += take;
+    n -= take;
+  }
+  return *this;
+}
+
+ChunkWriter& ChunkWriter::print(uint32_t v) {
+  char digits[10];
+  uint8_t n = 0;
+  do {
+    digits[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  while (n) put(digits[--n]);
+  return *this;
+}
+
+ChunkWriter& ChunkWriter::jsonString(const char* s) {
+  static const char HEX_DIGITS[] = "0123456789abcdef";
+  put('"');
+  for (; *s; s++) {
+    uint8_t c = *s;
+    if (c == '"' || c == '\\') {
+      put('\\');
+      put(c);
+    } else if (c < 0x20) {
+      write("\\u00", 4);
+      put(HEX_DIGITS[c >> 4]);
+      put(HEX_DIGITS[c & 0xF]);
+    } else {
+      put(c);
+    }
+  }
+  put('"');
+  return *this;
+}
+
+void ChunkWriter::finish() {
+  flush_(buf_, len_, total_ == 0, true);
+  total_ += len_;
+  len_ = 0;
+}
@@ -0,0 +1,109 @@
+#include "CommandParser.h"
+
+namespace {
+
+struct Cursor {
+  const char* p;
+  const char* end;
+};
+
+void skipSpace(Cursor& c) {
+  while (c.p < c.end && (*c.p == ' ' || *c.p == '\t' || *c.p == '\r' || *c.p == '\n')) c.p++;
+}
+
+bool consume(Cursor& c, char ch) {
+  skipSpace(c);
+  if (c.p >= c.end || *c.p != ch) return false;
+  c.p++;
+  return true;
+}
+
+// Strings are returned as slices of the input; escapes need the fallback.
+ParseResult readString(Cursor& c, const char*& s, size_t& n) {
+  if (!consume(c, '"')) return PARSE_INVALID;
+  s = c.p;
+  while (c.p < c.end && *c.p != '"') {
+    if (*c.p == '\\') return PARSE_FALLBACK;
+    c.p++;
+  }
+  if (c.p >= c.end) return PARSE_INVALID;
+  n = c.p - s;
+  c.p++;
+  return PARSE_OK;
+}
+
+bool sliceIs(const char* s, size_t n, const char* lit) {
+  return strlen(lit) == n && !memcmp(s, lit, n);
+}
+
+// Scalar value: string, integer, true/false/null. Objects and arrays and
+// fractional numbers are left to the fallback.
+ParseResult readScalar(Cursor& c, const char*& s, size_t& n, bool& isString, long& number) {
+  skipSpace(c);
+  if (c.p >= c.end) return PARSE_INVALID;
+  isString = false;
+  number = 0;
+  if (*c.p == '"') {
+    isString = true;
+    return readString(c, s, n);
+  }
+  if (*c.p == '{' || *c.p == '[') return PARSE_FALLBACK;
+  s = c.p;
+  if (*c.p == '-' || (*c.p >= '0' && *c.p <= '9')) {
+    bool neg = *c.p == '-';
+    if (neg) c.p++;
+    if (c.p >= c.end || *c.p < '0' || *c.p > '9') return PARSE_INVALID;
+    while (c.p < c.end && *c.p >= '0' && *c.p <= '9') {
+      if (number > 100000000L) return PARSE_FALLBACK;
+      number = number * 10 + (*c.p++ - '0');
+    }
+    if (c.p < c.end && (*c.p == '.' || *c.p == 'e' || *c.p == 'E')) return PARSE_FALLBACK;
+    if (neg) number = -number;
+    n = c.p - s;
+    return PARSE_OK;
+  }
+  while (c.p < c.end && *c.p >= 'a' && *c.p <= 'z') c.p++;
+  n = c.p - s;
+  if (sliceIs(s, n, "true")) number = 1;
+  else if (!sliceIs(s, n, "false") && !sliceIs(s, n, "null")) return PARSE_INVALID;
+  return PARSE_OK;
+}
+
+}  // namespace
+
+CommandAction commandAction(const char* value, size_t len) {
+  if (sliceIs(value, len, "on")) return CMD_ON;
+  if (sliceIs(value, len, "off")) return CMD_OFF;
+  if (sliceIs(value, len, "toggle")) return CMD_TOGGLE;
+  return CMD_UNKNOWN;
+}
+
+ParseResult parseCommand(const char* json, size_t len, RelayCommand& out) {
+  out.action = CMD_NONE;
+  out.channel = -1;
+  out.duration = 0;
+  Cursor c = {json, json + len};
+  if (!consume(c, '{')) return PARSE_INVALID;
+  if (consume(c, '}')) return PARSE_OK;
+  do {
+    const char *key, *val;
+    size_t keyLen, valLen;
+    bool isString;
+    long number;
+    ParseResult r = readString(c, key, keyLen);
+    if (r != PARSE_OK) return r;
+    if (!consume(c, ':')) return PARSE_INVALID;
+    r = readScalar(c, val, valLen, isString, number);
+    if (r != PARSE_OK) return r;
+    if (sliceIs(key, keyLen, "command")) {
+      out.action = isString ? commandAction(val, valLen) : CMD_NONE;
+    } else if (sliceIs(key, keyLen, "channel")) {
+      out.channel = (!isString && number >= 1 && number <= 32767) ? (int16_t)number : 0;
+    } else if (sliceIs(key, keyLen, "duration") && !isString) {
+      out.duration = number > 0 ? (uint32_t)number : 0;
+    }
+  } while (consume(c, ','));
+  if (!consume(c, '}')) return PARSE_INVALID;
+  skipSpace(c);
+  return c.p == c.end ? PARSE_OK : PARSE_INVALID;
+}
@@ -0,0 +1,39 @@
+#include "Outbox.h"
+
+bool Outbox::put(const char* topic, const char* payload, size_t len, bool retained) {
+  if (!topic || strlen(topic) >= OUTBOX_TOPIC_SIZE || len > OUTBOX_PAYLOAD_SIZE) {
+    dropped_++;
+    return false;
+  }
+  Slot* slot = nullptr;
+  for (uint8_t i = 0; i < count_ && !slot; i++) {
+    if (!strcmp(at(i).topic, topic)) slot = &at(i);
+  }
+  if (slot) {
+    replaced_++;
+  } else {
+    if (count_ == OUTBOX_SLOTS) { // Full: the oldest goes
+      head_ = (head_ + 1) % OUTBOX_SLOTS;
+      count_--;
+      dropped_++;
+    }
+    slot = &at(count_++);
+    strcpy(slot->topic, topic);
+    if (count_ > peak_) peak_ = count_;
+  }
+  memcpy(slot->payload, payload, len);
+  slot->len = len;
+  slot->retained = retained;
+  return true;
+}
+
+bool Outbox::drain(SendFn send, uint8_t max) {
+  while (count_ && max--) {
+    Slot& s = at(0);
+    if (!send(s.topic, s.payload, s.len, s.retained)) return false;
+    head_ = (head_ + 1) % OUTBOX_SLOTS;
+    count_--;
+    sent_++;
+  }
+  return !count_;
+}
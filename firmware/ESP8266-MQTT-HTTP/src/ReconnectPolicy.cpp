@@ -0,0 +1,26 @@
+#include "ReconnectPolicy.h"
+
+uint32_t ReconnectPolicy::next() {
+  uint32_t window = base_;
+  for (uint16_t i = 0; i < streak_ && window < cap_; i++) window <<= 1;
+  if (window > cap_) window = cap_;
+  if (streak_ < UINT16_MAX) streak_++;
+  retries_++;
+  return window - random(window / 2 + 1); // "Equal jitter": never less than half the window
+}
+
+void ReconnectPolicy::down() {
+  if (down_) return;
+  down_ = true;
+  downSince_ = millis();
+}
+
+void ReconnectPolicy::up() {
+  if (!down_) return;
+  down_ = false;
+  connects_++;
+  lastDownMs_ = millis() - downSince_;
+  if (lastDownMs_ > maxDownMs_) maxDownMs_ = lastDownMs_;
+  lastRetries_ = streak_;
+  streak_ = 0;
+}
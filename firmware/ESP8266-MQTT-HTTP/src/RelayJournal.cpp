@@ -0,0 +1,120 @@
+#include "RelayJournal.h"
+#include <flash_hal.h>
+
+// Sector: [magic:4][seq:4][record:4]...; erased words read 0xFFFFFFFF.
+// The magic tells journal sectors from whatever the FS region held before
+// (an old SPIFFS, an OTA image); those are ignored until the ring erases them.
+// Record bytes: tag, state, ~state, 0 so a torn write never validates.
+#define JOURNAL_MAGIC 0x314A5242UL // "BRJ1"
+#define JOURNAL_HEADER 8
+#define JOURNAL_TAG 0xA5
+#define ERASED_WORD 0xFFFFFFFFUL
+
+static uint32_t encodeRecord(uint8_t state) {
+  return JOURNAL_TAG | ((uint32_t)state << 8) | ((uint32_t)(uint8_t)~state << 16);
+}
+
+static bool decodeRecord(uint32_t word, uint8_t& state) {
+  if ((word & 0xFF) != JOURNAL_TAG || (word >> 24) != 0) return false;
+  state = (word >> 8) & 0xFF;
+  return ((word >> 16) & 0xFF) == (uint8_t)~state;
+}
+
+uint32_t RelayJournal::sectorAddr(uint8_t index) const {
+  return FS_PHYS_ADDR + (uint32_t)index * FLASH_SECTOR_SIZE;
+}
+
+uint32_t RelayJournal::readWord(uint32_t addr) const {
+  uint32_t word = ERASED_WORD;
+  ESP.flashRead(addr, &word, sizeof(word));
+  return word;
+}
+
+// Records are written front to back, so the used area is a prefix and
+// the first erased word can be found by bisection.
+uint32_t RelayJournal::findEnd(uint32_t base) const {
+  uint32_t lo = JOURNAL_HEADER / 4, hi = FLASH_SECTOR_SIZE / 4;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (readWord(base + mid * 4) == ERASED_WORD) hi = mid;
+    else lo = mid + 1;
+  }
+  return lo * 4;
+}
+
+// False for erased sectors, foreign data and a header torn before the seq.
+bool RelayJournal::sectorSeq(uint8_t index, uint32_t& seq) const {
+  if (readWord(sectorAddr(index)) != JOURNAL_MAGIC) return false;
+  seq = readWord(sectorAddr(index) + 4);
+  return seq != ERASED_WORD;
+}
+
+bool RelayJournal::lastRecord(uint8_t index, uint32_t end, uint8_t& state) const {
+  for (uint32_t off = end; off > JOURNAL_HEADER; off -= 4) {
+    if (decodeRecord(readWord(sectorAddr(index) + off - 4), state)) return true;
+  }
+  return false;
+}
+
+bool RelayJournal::openSector(uint8_t index, uint32_t seq) {
+  if (!ESP.flashEraseSector(sectorAddr(index) / FLASH_SECTOR_SIZE)) return false;
+  erases_++;
+  uint32_t header[2] = {JOURNAL_MAGIC, seq};
+  if (!ESP.flashWrite(sectorAddr(index), header, sizeof(header))) return false;
+  active_ = index;
+  seq_ = seq;
+  offset_ = JOURNAL_HEADER;
+  return true;
+}
+
+bool RelayJournal::begin() {
+  ready_ = false;
+  if (FS_PHYS_SIZE < JOURNAL_SECTORS * FLASH_SECTOR_SIZE) return false;
+
+  bool found = false;
+  for (uint8_t i = 0; i < JOURNAL_SECTORS; i++) {
+    uint32_t seq;
+    if (!sectorSeq(i, seq)) continue;
+    if (!found || (int32_t)(seq - seq_) > 0) {
+      found = true;
+      active_ = i;
+      seq_ = seq;
+    }
+  }
+  if (!found) {
+    ready_ = openSector(0, 1);
+    return ready_;
+  }
+
+  offset_ = findEnd(sectorAddr(active_));
+  hasState_ = lastRecord(active_, offset_, state_);
+  if (!hasState_) {
+    // Power lost right after a rollover: the previous sector still has it.
+    uint8_t prev = (active_ + JOURNAL_SECTORS - 1) % JOURNAL_SECTORS;
+    uint32_t seq;
+    if (sectorSeq(prev, seq) && seq == seq_ - 1) hasState_ = lastRecord(prev, findEnd(sectorAddr(prev)), state_);
+  }
+  ready_ = true;
+  return true;
+}
+
+bool RelayJournal::read(uint8_t& state) const {
+  if (!ready_ || !hasState_) return false;
+  state = state_;
+  return true;
+}
+
+bool RelayJournal::append(uint8_t state) {
+  if (!ready_) return false;
+  if (hasState_ && state == state_) return true;
+  // Compaction: the only live data is the latest state, so a full sector
+  // rolls over to the next one and that state becomes its first record.
+  if (offset_ >= FLASH_SECTOR_SIZE && !openSector((active_ + 1) % JOURNAL_SECTORS, seq_ + 1)) return false;
+  uint32_t word = encodeRecord(state);
+  if (!ESP.flashWrite(sectorAddr(active_) + offset_, &word, sizeof(word))) return false;
+  offset_ += 4;
+  state_ = state;
+  hasState_ = true;
+  appends_++;
+  return true;
+}
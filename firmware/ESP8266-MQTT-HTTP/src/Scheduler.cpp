@@ -0,0 +1,123 @@
+#include "Scheduler.h"
+
+int8_t Scheduler::add(const char* name, TaskFn fn, uint32_t period) {
+  if (!fn || count_ == SCHED_MAX_TASKS) return -1;
+  uint8_t id = count_++;
+  tasks_[id] = {name, fn, period, 0, 0, {}};
+  pos_[id] = -1;
+  return id;
+}
+
+int8_t Scheduler::every(const char* name, TaskFn fn, uint32_t period, uint32_t first) {
+  int8_t id = period ? add(name, fn, period) : -1;
+  if (id >= 0) wake(id, first);
+  return id;
+}
+
+int8_t Scheduler::once(const char* name, TaskFn fn) {
+  return add(name, fn, 0);
+}
+
+void Scheduler::wake(int8_t id, uint32_t delay) {
+  if (id < 0 || id >= count_) return;
+  uint32_t deadline = millis() + delay;
+  if (pending(id)) {
+    if ((int32_t)(deadline - tasks_[id].deadline) >= 0) return;
+    tasks_[id].deadline = deadline;
+    siftUp(pos_[id]);
+    return;
+  }
+  tasks_[id].deadline = deadline;
+  push(id);
+}
+
+void Scheduler::cancel(int8_t id) {
+  if (pending(id)) removeAt(pos_[id]);
+}
+
+void Scheduler::run() {
+  // Bounded by the tasks armed on entry, so one that wakes itself with no
+  // delay runs again next pass instead of spinning here.
+  for (uint8_t n = heapSize_; n && heapSize_; n--) {
+    uint8_t id = heap_[0];
+    Task& t = tasks_[id];
+    uint32_t now = millis();
+    if ((int32_t)(now - t.deadline) < 0) return;
+    Stats& s = t.stats;
+    uint32_t late = now - t.deadline;
+    if (late > s.lateMax) s.lateMax = late;
+    s.lateAvg = s.runs ? s.lateAvg + ((int32_t)(late * 1000 - s.lateAvg) >> 4) : late * 1000;
+    if (t.period && s.runs) {
+      uint32_t interval = now - t.lastRun;
+      uint32_t dev = (interval > t.period ? interval - t.period : t.period - interval) * 1000;
+      s.jitterAvg += (int32_t)(dev - s.jitterAvg) >> 4;
+    }
+    t.lastRun = now;
+    s.runs++;
+    removeAt(0);
+    if (t.period) {
+      t.deadline += t.period;
+      if ((int32_t)(now - t.deadline) >= 0) t.deadline = now + t.period; // After a stall: skip, do not catch up
+      push(id);
+    }
+    uint32_t start = micros();
+    t.fn();
+    uint32_t us = micros() - start;
+    if (us > s.runMax) s.runMax = us;
+  }
+}
+
+uint32_t Scheduler::idle() const {
+  if (!heapSize_) return UINT32_MAX;
+  int32_t left = (int32_t)(tasks_[heap_[0]].deadline - millis());
+  return left > 0 ? left : 0;
+}
+
+void Scheduler::resetMax() {
+  for (uint8_t i = 0; i < count_; i++) {
+    tasks_[i].stats.lateMax = 0;
+    tasks_[i].stats.runMax = 0;
+  }
+}
+
+void Scheduler::swap(uint8_t a, uint8_t b) {
+  uint8_t t = heap_[a];
+  heap_[a] = heap_[b];
+  heap_[b] = t;
+  pos_[heap_[a]] = a;
+  pos_[heap_[b]] = b;
+}
+
+void Scheduler::siftUp(uint8_t i) {
+  while (i && before(i, (i - 1) / 2)) {
+    swap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+void Scheduler::siftDown(uint8_t i) {
+  for (;;) {
+    uint8_t min = i, l = 2 * i + 1, r = l + 1;
+    if (l < heapSize_ && before(l, min)) min = l;
+    if (r < heapSize_ && before(r, min)) min = r;
+    if (min == i) return;
+    swap(i, min);
+    i = min;
+  }
+}
+
+void Scheduler::push(uint8_t id) {
+  heap_[heapSize_] = id;
+  pos_[id] = heapSize_;
+  siftUp(heapSize_++);
+}
+
+void Scheduler::removeAt(uint8_t i) {
+  uint8_t id = heap_[i];
+  pos_[id] = -1;
+  if (i == --heapSize_) return;
+  heap_[i] = heap_[heapSize_];
+  pos_[heap_[i]] = i;
+  if (i && before(i, (i - 1) / 2)) siftUp(i);
+  else siftDown(i);
+}
@@ -0,0 +1,31 @@
+#include "TopicRouter.h"
+
+uint32_t TopicRouter::hash(const char* s) {
+  uint32_t h = 2166136261UL;
+  while (*s) {
+    h ^= (uint8_t)*s++;
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+bool TopicRouter::add(const char* topic, TopicHandler fn, uint8_t arg) {
+  if (!topic || !*topic || !fn || count_ == MAX_TOPIC_ROUTES) return false;
+  uint32_t h = hash(topic);
+  for (uint8_t i = 0; i < count_; i++) {
+    if (routes_[i].hash == h && !strcmp(routes_[i].topic, topic)) return false; // First route wins
+  }
+  routes_[count_++] = {h, topic, fn, arg};
+  return true;
+}
+
+bool TopicRouter::dispatch(const char* topic, byte* payload, unsigned int len) const {
+  uint32_t h = hash(topic);
+  for (uint8_t i = 0; i < count_; i++) {
+    const Route& r = routes_[i];
+    if (r.hash != h || strcmp(r.topic, topic)) continue;
+    r.fn(r.arg, payload, len);
+    return true;
+  }
+  return false;
+}
@@ -1,38 +1,85 @@
 #include <Arduino.h>
 #include <ESP8266WiFi.h>
-#include <ESP8266WebServer.h>
 #include <ESP8266mDNS.h>
 #include <PubSubClient.h>
 #include <EEPROM.h>
 #include <ArduinoJson.h>
+#include <lwip/dns.h>
+#include "AsyncHttpServer.h"
+#include "AsyncMqttTransport.h"
+#include "ChunkWriter.h"
+#include "CommandParser.h"
+#include "Outbox.h"
+#include "ReconnectPolicy.h"
+#include "RelayJournal.h"
+#include "Scheduler.h"
+#include "TopicRouter.h"
+#include "web_index.h"
 /* =======================
    Hardware Configuration
    ======================= */
-#define RELAY_PIN 2
+#ifndef RELAY_PINS
+#define RELAY_PINS 2 // Comma-separated GPIOs (0-15), one per channel
+#endif
 #define RELAY_ACTIVE_LOW true
-#define EEPROM_SIZE 512
-#define MAGIC_VAL 0xA5
+#define EEPROM_SIZE 512 // Bound for the config image; a flush writes only what it holds
 /* =======================
    Timing & Stability
    ======================= */
 #define EEPROM_WRITE_COOLDOWN 5000UL
-#define MQTT_RECONNECT_DELAY 5000UL
-#define WIFI_RECONNECT_DELAY 10000UL
+#define RELAY_WRITE_COOLDOWN 1000UL // Journal appends are cheap; still coalesce bursts
+#define MQTT_RECONNECT_DELAY 5000UL // First retry window; doubles per failure
+#define MQTT_RECONNECT_MAX 300000UL
+#define MQTT_PHASE_TIMEOUT 10000UL // Per connect step (DNS, TCP, CONNACK)
+#ifndef MQTT_CONNACK_TIMEOUT
+#define MQTT_CONNACK_TIMEOUT 2 // Seconds; the one step that blocks loop(), see MQ_SESSION
+#endif
+#define WIFI_RECONNECT_DELAY 15000UL // Half of it is the shortest wait; association takes seconds
+#define WIFI_RECONNECT_MAX 120000UL
+#define WIFI_FAST_TIMEOUT 2000UL // Cached channel/BSSID attempt, then a full scan
+#define WIFI_CACHE_RTC 32 // RTC user memory block; the first 128 bytes belong to eboot (OTA)
+#ifndef WIFI_REUSE_LEASE
+#define WIFI_REUSE_LEASE 1 // 0: fast reconnect still runs DHCP
+#endif
 #define HEARTBEAT_INTERVAL 60000UL
-#define MIN_SAFE_HEAP 7500 // Threshold to kill AP
-#define SAFE_HEAP_RECOVER 11500 // Threshold to restore AP
+#define AP_RETRY_INTERVAL 30000UL // softAP() writes flash; a failed switch is not retried every pass
+#define POWER_LATENCY_DEFAULT 300 // ms; worst-case command latency in power save
+#define POWER_LATENCY_MIN 150 // One beacon interval plus some loop idle
+#define POWER_LATENCY_MAX 1100 // Listen interval tops out at 10 beacons
+#define POWER_IDLE_MAX 50 // ms of loop() delay per pass at most
+#define BEACON_INTERVAL_MS 102 // 100 TU, the usual AP default
+#define HEAP_SAMPLE_INTERVAL 250UL // getMaxFreeBlockSize() walks the free list
+#define TIMERS_JSON_SIZE 512
+#define MQTT_BUFFER_SIZE 640 // Fits the perf report
+#define MQTT_BUFFER_LOW 480 // Degraded: the state snapshot still fits, the perf report does not
+#define PERF_JSON_SIZE 576
+#define SNAPSHOT_HEAP_DELTA 1024 // Telemetry change that forces a snapshot rebuild
+#define SNAPSHOT_RSSI_DELTA 5
+#define EVENTS_CHECK_INTERVAL 1000UL // Telemetry drift check for /events subscribers
+#ifndef STATE_PUBLISH_WINDOW
+#define STATE_PUBLISH_WINDOW 250UL // Command burst collapsed into one state publish; 0 = every change
+#endif
+#ifndef GROUP_TOPIC
+#define GROUP_TOPIC "home/switch/all/control" // Broadcast to every device
+#endif
 /* =======================
    Global Objects
    ======================= */
-ESP8266WebServer server(80);
-WiFiClient wifiClient;
-PubSubClient mqtt(wifiClient);
+AsyncHttpServer server(80);
+AsyncMqttTransport mqttTransport;
+PubSubClient mqtt(mqttTransport);
+Outbox outbox;
+static_assert(PERF_JSON_SIZE <= OUTBOX_PAYLOAD_SIZE && TIMERS_JSON_SIZE <= OUTBOX_PAYLOAD_SIZE, "a heartbeat report that meets a full send buffer is queued");
+Scheduler scheduler;
+// random() is the hardware RNG unless randomSeed() is called, so every
+// device draws its own jitter.
+ReconnectPolicy wifiPolicy(WIFI_RECONNECT_DELAY, WIFI_RECONNECT_MAX);
+ReconnectPolicy mqttPolicy(MQTT_RECONNECT_DELAY, MQTT_RECONNECT_MAX);
 struct Config {
-  uint8_t magic;
   char hostname[32];
   char ssid[32];
   char pass[64];
-  uint8_t last_state;
+  uint8_t last_state; // Channel bitmask; fallback when RelayJournal has no record
   char mqtt_broker[64];
   uint16_t mqtt_port;
   char mqtt_user[32];
@@ -40,181 +87,1195 @@ struct Config {
   char pub_topic[64]; // State Topic (JSON)
   char sub_topic[64]; // Command Topic (JSON)
   char avail_topic[64]; // Availability Topic (online/offline)
+  uint8_t power_mode; // PowerMode
+  uint16_t max_latency; // ms, command latency bound in power save
+  uint32_t ip_addr; // Static station address; 0 = DHCP
+  uint32_t ip_gateway;
+  uint32_t ip_mask;
+  uint32_t ip_dns; // 0 = the gateway
 };
 Config config;
-unsigned long lastEepromWrite = 0, lastMqttAttempt = 0, lastWifiAttempt = 0, lastHeartbeat = 0;
+// Last good association, stored with the config; see loadWifiCache().
+struct WifiCache {
+  uint32_t check; // FNV-1a over the SSID and the fields below
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t reserved;
+  uint32_t ip, gateway, mask, dns;
+};
+WifiCache wifiCache;
+bool wifiCacheValid = false;
+constexpr uint8_t RELAY_PIN_LIST[] = {RELAY_PINS};
+constexpr uint8_t RELAY_CHANNELS = sizeof(RELAY_PIN_LIST);
+constexpr uint8_t RELAY_ALL = (1U << RELAY_CHANNELS) - 1;
+constexpr bool relayPinsValid(uint8_t i = 0) { return i == RELAY_CHANNELS || (RELAY_PIN_LIST[i] < 16 && relayPinsValid(i + 1)); }
+static_assert(RELAY_CHANNELS >= 1 && RELAY_CHANNELS <= 8, "last_state holds one bit per channel");
+static_assert(relayPinsValid(), "GPOS/GPOC only reach GPIO0-15");
+RelayJournal relayJournal;
 bool apDisabledByGuard = false;
+bool mdnsStarted = false; // MDNS.begin() worked at boot; the guard only restores what ran
+bool mdnsUp = false;
+enum PowerMode : uint8_t { POWER_OFF, POWER_MODEM, POWER_LIGHT };
+uint8_t degradeTier = 0; // heapGuard() level, see DegradeTier
+uint8_t topicRejects = 0; // Routes add() refused: an empty topic or one that collides with another
+bool wifiFast = false; // Current station attempt uses the cached BSSID/channel/lease
+bool snapshotDirty = true; // Set on anything the state snapshot reports
+uint32_t statePublishes = 0, publishCoalesced = 0; // Coalesced: changes that rode on a later publish
+/* =======================
+   Loop Profiling
+   ======================= */
+enum LoopStage : uint8_t { STAGE_HTTP, STAGE_MDNS, STAGE_MQTT_CONN, STAGE_MQTT_LOOP, STAGE_TIMERS, STAGE_LOOP, STAGE_COUNT };
+const char* const STAGE_NAMES[STAGE_COUNT] = {"http", "mdns", "mqtt_conn", "mqtt_loop", "timers", "loop"};
+struct StageStat {
+  uint32_t maxCycles; // Since the last heartbeat
+  uint32_t avgCycles; // EWMA, 1/16 weight
+  uint32_t count;
+};
+StageStat stageStats[STAGE_COUNT];
+#define PERF_STAGE(stage, call) do { uint32_t _c0 = ESP.getCycleCount(); call; recordStage(stage, ESP.getCycleCount() - _c0); } while (0)
+void recordStage(uint8_t stage, uint32_t cycles) {
+  StageStat& s = stageStats[stage];
+  if (cycles > s.maxCycles) s.maxCycles = cycles;
+  s.avgCycles = s.count ? s.avgCycles + ((int32_t)(cycles - s.avgCycles) >> 4) : cycles;
+  s.count++;
+}
+size_t perfJson(char* out, size_t size) {
+  uint32_t mhz = ESP.getCpuFreqMHz();
+  JsonDocument doc;
+  doc["uptime"] = millis() / 1000;
+  for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+    JsonObject st = doc[STAGE_NAMES[i]].to<JsonObject>();
+    st["max_us"] = stageStats[i].maxCycles / mhz;
+    st["avg_us"] = stageStats[i].avgCycles / mhz;
+    st["n"] = stageStats[i].count;
+  }
+  doc["state_pub"]["n"] = statePublishes;
+  doc["state_pub"]["coalesced"] = publishCoalesced;
+  JsonObject ob = doc["outbox"].to<JsonObject>();
+  ob["depth"] = outbox.depth();
+  ob["peak"] = outbox.peak();
+  ob["sent"] = outbox.sent();
+  ob["replaced"] = outbox.replaced();
+  ob["dropped"] = outbox.dropped();
+  return serializeJson(doc, out, size);
+}
+void resetStageMax() {
+  for (uint8_t i = 0; i < STAGE_COUNT; i++) stageStats[i].maxCycles = 0;
+}
+/* Boot timeline: first time each milestone is reached, in micros() since
+   reset, published once after the first state publish. One that is not
+   reached within micros()' 71-minute range is left out. */
+enum BootMark : uint8_t { BOOT_SETUP, BOOT_GPIO, BOOT_EEPROM, BOOT_CONFIG, BOOT_RELAY, BOOT_AP, BOOT_MDNS, BOOT_LOOP, BOOT_IP, BOOT_CONNACK, BOOT_PUBLISH, BOOT_COUNT };
+const char* const BOOT_NAMES[BOOT_COUNT] = {"setup", "gpio", "eeprom", "config", "relay", "ap", "mdns", "loop", "ip", "connack", "publish"};
+uint32_t bootMarks[BOOT_COUNT];
+bool bootReported = false;
+void bootMark(BootMark m) {
+  if (bootMarks[m] || millis() >= 4294000UL) return;
+  uint32_t us = micros();
+  bootMarks[m] = us ? us : 1;
+}
+// Per scheduler task, which the stage stats above only see as "timers":
+// [runs, late_max_ms, late_avg_us, jitter_us, run_max_us], positional so
+// every task fits one MQTT packet.
+size_t timersJson(char* out, size_t size) {
+  JsonDocument doc;
+  for (uint8_t i = 0; i < scheduler.size(); i++) {
+    const Scheduler::Stats& s = scheduler.stats(i);
+    JsonArray t = doc[scheduler.name(i)].to<JsonArray>();
+    t.add(s.runs);
+    t.add(s.lateMax);
+    t.add(s.lateAvg);
+    t.add(s.jitterAvg);
+    t.add(s.runMax);
+  }
+  return serializeJson(doc, out, size);
+}
 /* =======================
    Persistence
    ======================= */
+/* Write-behind: changes only mark a slot dirty and wake its timer. The
+   first change after a quiet period is written on the next pass; changes
+   inside the cooldown are coalesced and written once when it expires, so
+   the last one is never lost. */
+struct WriteBehind {
+  unsigned long cooldown;
+  unsigned long lastWrite;
+  bool written;
+  bool dirty;
+  uint32_t pending; // Changes waiting for the next flush
+  uint32_t flushed;
+  int8_t task; // Scheduler one-shot that flushes it
+};
+WriteBehind configWb = {EEPROM_WRITE_COOLDOWN, 0, false, false, 0, 0, -1};
+WriteBehind relayWb = {RELAY_WRITE_COOLDOWN, 0, false, false, 0, 0, -1};
+void markDirty(WriteBehind& wb) {
+  wb.dirty = true;
+  wb.pending++;
+  snapshotDirty = true;
+  unsigned long since = millis() - wb.lastWrite;
+  scheduler.wake(wb.task, (!wb.written || since >= wb.cooldown) ? 0 : wb.cooldown - since);
+}
+bool flushDue(const WriteBehind& wb) {
+  return wb.dirty && (!wb.written || millis() - wb.lastWrite >= wb.cooldown);
+}
+void markFlushed(WriteBehind& wb) {
+  wb.dirty = false;
+  wb.written = true;
+  wb.lastWrite = millis();
+  wb.pending = 0;
+  wb.flushed++;
+  snapshotDirty = true;
+}
 void saveConfig() {
-  if (millis() - lastEepromWrite < EEPROM_WRITE_COOLDOWN) return;
-  EEPROM.put(0, config);
-  EEPROM.commit();
-  lastEepromWrite = millis();
+  markDirty(configWb);
+}
+/* Config image at the start of the EEPROM sector: a header, then one
+   record per field as tag, length and bytes. Strings are stored without
+   their padding, so a typical image is about 200 bytes and a flush writes
+   only that. The CRC covers the header and the records, so a torn write
+   reads as no config. A reader skips tags it does not know and leaves the
+   ones it does not find at their defaults: adding a field needs no
+   migration, and CONFIG_VERSION only changes when a stored field changes
+   meaning. Tags are never renumbered or reused. */
+#define CONFIG_MAGIC 0xC5 // Not LEGACY_MAGIC, so the two formats cannot be confused
+#define CONFIG_VERSION 1
+struct ConfigHeader {
+  uint8_t magic;
+  uint8_t version;
+  uint16_t length; // Record bytes after the header
+  uint32_t crc;    // CRC-32 over the first four header bytes and the records
+};
+enum ConfigTag : uint8_t {
+  TAG_HOSTNAME = 1, TAG_SSID, TAG_PASS, TAG_LAST_STATE, TAG_BROKER, TAG_PORT, TAG_MQTT_USER, TAG_MQTT_PASS,
+  TAG_PUB_TOPIC, TAG_SUB_TOPIC, TAG_AVAIL_TOPIC, TAG_POWER_MODE, TAG_MAX_LATENCY,
+  TAG_IP_ADDR, TAG_IP_GATEWAY, TAG_IP_MASK, TAG_IP_DNS, TAG_WIFI_CACHE
+};
+// Before the header the sector held the Config struct as is, magic first.
+// Frozen: it only describes images written by older firmware.
+#define LEGACY_MAGIC 0xA5
+#define LEGACY_WIFI_CACHE (EEPROM_SIZE - sizeof(WifiCache))
+struct LegacyConfig {
+  uint8_t magic;
+  char hostname[32];
+  char ssid[32];
+  char pass[64];
+  uint8_t last_state;
+  char mqtt_broker[64];
+  uint16_t mqtt_port;
+  char mqtt_user[32];
+  char mqtt_pass[32];
+  char pub_topic[64];
+  char sub_topic[64];
+  char avail_topic[64];
+  uint8_t power_mode; // Fields from here on were appended; older images read all ones
+  uint16_t max_latency;
+  uint32_t ip_addr;
+  uint32_t ip_gateway;
+  uint32_t ip_mask;
+  uint32_t ip_dns;
+};
+struct ConfigRecord {
+  uint8_t tag;
+  bool text; // NUL-terminated in Config, stored without it
+  uint16_t offset;
+  uint16_t legacyOffset;
+  uint8_t size;
+};
+#define CONFIG_RECORD(tag, field, text) {tag, text, offsetof(Config, field), offsetof(LegacyConfig, field), sizeof(Config::field)}
+constexpr ConfigRecord CONFIG_RECORDS[] = {
+  CONFIG_RECORD(TAG_HOSTNAME, hostname, true),
+  CONFIG_RECORD(TAG_SSID, ssid, true),
+  CONFIG_RECORD(TAG_PASS, pass, true),
+  CONFIG_RECORD(TAG_LAST_STATE, last_state, false),
+  CONFIG_RECORD(TAG_BROKER, mqtt_broker, true),
+  CONFIG_RECORD(TAG_PORT, mqtt_port, false),
+  CONFIG_RECORD(TAG_MQTT_USER, mqtt_user, true),
+  CONFIG_RECORD(TAG_MQTT_PASS, mqtt_pass, true),
+  CONFIG_RECORD(TAG_PUB_TOPIC, pub_topic, true),
+  CONFIG_RECORD(TAG_SUB_TOPIC, sub_topic, true),
+  CONFIG_RECORD(TAG_AVAIL_TOPIC, avail_topic, true),
+  CONFIG_RECORD(TAG_POWER_MODE, power_mode, false),
+  CONFIG_RECORD(TAG_MAX_LATENCY, max_latency, false),
+  CONFIG_RECORD(TAG_IP_ADDR, ip_addr, false),
+  CONFIG_RECORD(TAG_IP_GATEWAY, ip_gateway, false),
+  CONFIG_RECORD(TAG_IP_MASK, ip_mask, false),
+  CONFIG_RECORD(TAG_IP_DNS, ip_dns, false),
+};
+constexpr size_t CONFIG_RECORD_COUNT = sizeof(CONFIG_RECORDS) / sizeof(CONFIG_RECORDS[0]);
+constexpr size_t configImageMax(size_t i = 0) {
+  return i == CONFIG_RECORD_COUNT ? sizeof(ConfigHeader) : 2 + CONFIG_RECORDS[i].size - CONFIG_RECORDS[i].text + configImageMax(i + 1);
+}
+static_assert(configImageMax() <= EEPROM_SIZE, "config image can outgrow the EEPROM sector");
+uint32_t crc32Update(uint32_t crc, const uint8_t* p, size_t n) {
+  while (n--) {
+    crc ^= *p++;
+    for (uint8_t k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+  }
+  return crc;
+}
+uint32_t configCrc(const uint8_t* image, size_t length) {
+  uint32_t crc = crc32Update(0xFFFFFFFFUL, image, offsetof(ConfigHeader, crc));
+  return ~crc32Update(crc, image + sizeof(ConfigHeader), length);
+}
+uint8_t* putRecord(uint8_t* p, uint8_t tag, const void* data, uint8_t len) {
+  *p++ = tag;
+  *p++ = len;
+  memcpy(p, data, len);
+  return p + len;
+}
+size_t encodeConfig(uint8_t* image, size_t size) {
+  uint8_t* p = image + sizeof(ConfigHeader);
+  for (const ConfigRecord& r : CONFIG_RECORDS) {
+    const char* field = (const char*)&config + r.offset;
+    p = putRecord(p, r.tag, field, r.text ? strnlen(field, r.size - 1) : r.size);
+  }
+  // Optional: with every string at full length it does not fit, and the
+  // RTC copy still covers resets.
+  if (wifiCacheValid && p + 2 + sizeof(WifiCache) <= image + size) p = putRecord(p, TAG_WIFI_CACHE, &wifiCache, sizeof(WifiCache));
+  ConfigHeader h = {CONFIG_MAGIC, CONFIG_VERSION, (uint16_t)(p - image - sizeof(h)), 0};
+  memcpy(image, &h, sizeof(h));
+  h.crc = configCrc(image, h.length);
+  memcpy(image, &h, sizeof(h));
+  return p - image;
+}
+bool decodeConfig(const uint8_t* image, size_t size) {
+  ConfigHeader h;
+  memcpy(&h, image, sizeof(h));
+  if (h.magic != CONFIG_MAGIC || h.length > size - sizeof(h) || h.crc != configCrc(image, h.length)) return false;
+  const uint8_t* p = image + sizeof(h);
+  const uint8_t* end = p + h.length;
+  while (end - p >= 2 && end - p >= 2 + p[1]) {
+    uint8_t tag = p[0], len = p[1];
+    const uint8_t* data = p + 2;
+    p += 2 + len;
+    if (tag == TAG_WIFI_CACHE && len == sizeof(WifiCache)) memcpy(&wifiCache, data, len);
+    for (const ConfigRecord& r : CONFIG_RECORDS) {
+      if (r.tag != tag) continue;
+      char* field = (char*)&config + r.offset;
+      if (r.text) {
+        size_t n = len < r.size ? len : r.size - 1;
+        memcpy(field, data, n);
+        field[n] = '\0';
+      } else if (len == r.size) {
+        memcpy(field, data, len);
+      }
+      break;
+    }
+  }
+  // Field-level changes between versions go here, keyed on h.version.
+  if (h.version < CONFIG_VERSION) saveConfig(); // Rewrite in this version
+  return true;
+}
+void migrateLegacyConfig(const uint8_t* image) {
+  for (const ConfigRecord& r : CONFIG_RECORDS) {
+    char* field = (char*)&config + r.offset;
+    memcpy(field, image + r.legacyOffset, r.size);
+    if (r.text) field[r.size - 1] = '\0';
+  }
+  if (config.ip_addr == 0xFFFFFFFFUL) config.ip_addr = config.ip_gateway = config.ip_mask = config.ip_dns = 0;
+  memcpy(&wifiCache, image + LEGACY_WIFI_CACHE, sizeof(WifiCache));
 }
+// The RAM copy is only held while the image is written.
+void writeConfig() {
+  uint8_t image[EEPROM_SIZE];
+  size_t len = encodeConfig(image, sizeof(image));
+  EEPROM.begin(len);
+  memcpy(EEPROM.getDataPtr(), image, len);
+  EEPROM.end();
+}
+void persistTick(bool force = false) {
+  if (relayWb.dirty && (force || flushDue(relayWb))) {
+    if (!relayJournal.append(config.last_state)) saveConfig(); // No spare flash: old path
+    markFlushed(relayWb);
+  }
+  if (configWb.dirty && (force || flushDue(configWb))) {
+    writeConfig();
+    markFlushed(configWb);
+  }
+}
+// A static address needs a gateway and a contiguous mask that starts with
+// 255: WiFi.config() takes any other mask for the Arduino argument order
+// and swaps its arguments.
+bool staticIpValid() {
+  if (!config.ip_addr) return true;
+  IPAddress m(config.ip_mask);
+  uint32_t inv = ~(((uint32_t)m[0] << 24) | ((uint32_t)m[1] << 16) | ((uint32_t)m[2] << 8) | m[3]);
+  return config.ip_gateway && m[0] == 255 && !(inv & (inv + 1));
+}
+// Between EEPROM.begin() and EEPROM.end() in setup().
 void loadConfig() {
-  EEPROM.get(0, config);
-  if (config.magic != MAGIC_VAL) {
-    memset(&config, 0, sizeof(Config));
-    config.magic = MAGIC_VAL;
-    strcpy(config.hostname, "BedTimeESP");
-    strcpy(config.pub_topic, "home/switch/status");
-    strcpy(config.sub_topic, "home/switch/control");
-    strcpy(config.avail_topic, "home/switch/availability");
-    config.last_state = 0;
-    config.mqtt_port = 1883;
+  memset(&config, 0, sizeof(Config));
+  strcpy(config.hostname, "BedTimeESP");
+  strcpy(config.pub_topic, "home/switch/status");
+  strcpy(config.sub_topic, "home/switch/control");
+  strcpy(config.avail_topic, "home/switch/availability");
+  config.mqtt_port = 1883;
+  config.max_latency = POWER_LATENCY_DEFAULT;
+  const uint8_t* image = EEPROM.getConstDataPtr();
+  if (!decodeConfig(image, EEPROM.length())) {
+    if (image[0] == LEGACY_MAGIC) migrateLegacyConfig(image);
     saveConfig();
   }
+  if (config.power_mode > POWER_LIGHT) config.power_mode = POWER_OFF;
+  if (config.max_latency < POWER_LATENCY_MIN || config.max_latency > POWER_LATENCY_MAX) config.max_latency = POWER_LATENCY_DEFAULT;
+  if (!staticIpValid()) config.ip_addr = 0; // Saved before the check: DHCP
+}
+// String fields settable from the /save form and the MQTT config topic.
+struct ConfigField {
+  const char* key;
+  size_t offset;
+  size_t size;
+  bool session; // Part of the broker session: a change over MQTT reconnects and resubscribes
+};
+const ConfigField CONFIG_FIELDS[] = {
+  {"ssid", offsetof(Config, ssid), sizeof(Config::ssid), false},
+  {"pass", offsetof(Config, pass), sizeof(Config::pass), false},
+  {"host", offsetof(Config, hostname), sizeof(Config::hostname), false},
+  {"broker", offsetof(Config, mqtt_broker), sizeof(Config::mqtt_broker), true},
+  {"m_user", offsetof(Config, mqtt_user), sizeof(Config::mqtt_user), true},
+  {"m_pass", offsetof(Config, mqtt_pass), sizeof(Config::mqtt_pass), true},
+  {"pub_t", offsetof(Config, pub_topic), sizeof(Config::pub_topic), true},
+  {"sub_t", offsetof(Config, sub_topic), sizeof(Config::sub_topic), true},
+  {"avail_t", offsetof(Config, avail_topic), sizeof(Config::avail_topic), true},
+};
+bool setConfigField(const ConfigField& f, const char* value) {
+  char* dest = (char*)&config + f.offset;
+  if (!strncmp(dest, value, f.size - 1)) return false;
+  strncpy(dest, value, f.size);
+  dest[f.size - 1] = '\0';
+  return true;
+}
+// Static addressing, dotted quads in the form, the config topic and
+// /config.json; an empty value clears the field.
+struct IpField {
+  const char* key;
+  size_t offset;
+};
+const IpField IP_FIELDS[] = {
+  {"ip", offsetof(Config, ip_addr)},
+  {"gw", offsetof(Config, ip_gateway)},
+  {"mask", offsetof(Config, ip_mask)},
+  {"dns", offsetof(Config, ip_dns)},
+};
+constexpr size_t IP_FIELD_COUNT = sizeof(IP_FIELDS) / sizeof(IP_FIELDS[0]);
+uint32_t& configIp(const IpField& f) {
+  return *(uint32_t*)((char*)&config + f.offset);
+}
+bool setConfigIp(const IpField& f, const char* value) {
+  IPAddress ip;
+  if (*value && !ip.fromString(value)) return false;
+  uint32_t& dest = configIp(f);
+  if (dest == (uint32_t)ip) return false;
+  dest = ip;
+  return true;
+}
+// After a form or config message set its fields one by one: the address
+// is taken as a whole or not at all. False when it was put back.
+bool commitStaticIp(const uint32_t (&before)[IP_FIELD_COUNT]) {
+  if (staticIpValid()) return true;
+  for (size_t i = 0; i < IP_FIELD_COUNT; i++) configIp(IP_FIELDS[i]) = before[i];
+  return false;
+}
+void formatIp(uint32_t ip, char* out, size_t size) {
+  IPAddress a(ip);
+  if (ip) snprintf(out, size, "%u.%u.%u.%u", a[0], a[1], a[2], a[3]);
+  else out[0] = '\0';
+}
+bool setConfigPort(long p) {
+  if (p < 1 || p > 65535 || p == config.mqtt_port) return false;
+  config.mqtt_port = (uint16_t)p;
+  return true;
+}
+bool setConfigPower(long mode) {
+  if (mode < POWER_OFF || mode > POWER_LIGHT || mode == config.power_mode) return false;
+  config.power_mode = (uint8_t)mode;
+  return true;
+}
+bool setConfigMaxLatency(long ms) {
+  if (ms < POWER_LATENCY_MIN || ms > POWER_LATENCY_MAX || ms == config.max_latency) return false;
+  config.max_latency = (uint16_t)ms;
+  return true;
+}
+/* =======================
+   Power Save
+   ======================= */
+/* Modem sleep turns the radio off between DTIM beacons; light sleep also
+   pauses the CPU while loop() idles in delay(). A command then waits at
+   most one listen interval for the radio plus one idle delay for loop(),
+   and max_latency is split between the two. The SDK only sleeps in pure
+   STA mode, so the AP is dropped while the station is connected. */
+uint8_t powerIdleMs = 0;
+bool apUp = true;
+int8_t apTask = -1; // Armed after a failed switch; retries it
+void updateAp() {
+  bool want = !apDisabledByGuard && !(config.power_mode != POWER_OFF && WiFi.status() == WL_CONNECTED);
+  if (want == apUp) {
+    scheduler.cancel(apTask);
+    return;
+  }
+  if (scheduler.pending(apTask)) return;
+  apUp = want ? WiFi.softAP(config.hostname) : !WiFi.softAPdisconnect(true);
+  snapshotDirty = true;
+  if (apUp != want) scheduler.wake(apTask, AP_RETRY_INTERVAL);
+}
+void applyPowerMode() {
+  if (config.power_mode == POWER_OFF) {
+    powerIdleMs = 0;
+    WiFi.setSleepMode(WIFI_NONE_SLEEP);
+  } else {
+    powerIdleMs = config.max_latency / 5 < POWER_IDLE_MAX ? config.max_latency / 5 : POWER_IDLE_MAX;
+    uint16_t beacons = (config.max_latency - powerIdleMs) / BEACON_INTERVAL_MS;
+    uint8_t listen = beacons < 1 ? 1 : beacons > 10 ? 10 : beacons;
+    WiFi.setSleepMode(config.power_mode == POWER_LIGHT ? WIFI_LIGHT_SLEEP : WIFI_MODEM_SLEEP, listen);
+  }
+  updateAp();
+}
+// End of loop(): idle only when no request or queued publish is waiting,
+// and wake for the next timer rather than past it.
+void powerIdle() {
+  updateAp();
+  if (!powerIdleMs || server.active() || !outbox.empty()) return;
+  uint32_t wait = scheduler.idle();
+  if (wait) delay(wait < powerIdleMs ? wait : powerIdleMs);
+}
+/* =======================
+   Heap Telemetry
+   ======================= */
+/* Largest free block and fragmentation as sampled by heapGuard(): min, max
+   and a coarse histogram per heartbeat window, carried in the snapshot. */
+const uint32_t BLOCK_EDGES[] = {2048, 4096, 8192, 16384}; // <2K, <4K, <8K, <16K, more
+const uint32_t FRAG_EDGES[] = {10, 25, 50};                // <10%, <25%, <50%, more
+struct HeapStat {
+  uint32_t min, max;
+  uint16_t samples;
+  uint16_t hist[5];
+};
+HeapStat blockStat, fragStat;
+void recordHeapStat(HeapStat& st, uint32_t v, const uint32_t* edges, uint8_t edgeCount) {
+  if (!st.samples || v < st.min) st.min = v;
+  if (!st.samples || v > st.max) st.max = v;
+  st.samples++;
+  uint8_t b = 0;
+  while (b < edgeCount && v >= edges[b]) b++;
+  st.hist[b]++;
+}
+size_t heapStatJson(char* out, size_t size, const HeapStat& st, uint8_t buckets) {
+  int n = snprintf(out, size, "{\"min\":%u,\"max\":%u,\"hist\":[", (unsigned)st.min, (unsigned)st.max);
+  for (uint8_t b = 0; b < buckets && n > 0 && (size_t)n < size; b++) {
+    n += snprintf(out + n, size - n, b ? ",%u" : "%u", (unsigned)st.hist[b]);
+  }
+  if (n > 0 && (size_t)n < size) n += snprintf(out + n, size - n, "]}");
+  return (n > 0 && (size_t)n < size) ? n : 0;
+}
+void resetHeapStats() {
+  memset(&blockStat, 0, sizeof(blockStat));
+  memset(&fragStat, 0, sizeof(fragStat));
+}
+/* =======================
+   State Snapshot
+   ======================= */
+/* One pre-serialized payload shared by publishState(), /status and the
+   /events stream. It is rebuilt only when something it reports changes,
+   or when heap/RSSI drift past their thresholds; otherwise every path
+   sends these bytes. Each rebuild is pushed to event subscribers. */
+char stateSnapshot[384];
+size_t stateSnapshotLen = 0;
+uint32_t snapshotHeap = 0;
+int32_t snapshotRssi = 0;
+bool refreshSnapshot() {
+  uint32_t heap = ESP.getFreeHeap();
+  int32_t rssi = (WiFi.status() == WL_CONNECTED) ? WiFi.RSSI() : 0;
+  if (!snapshotDirty && abs((int32_t)(heap - snapshotHeap)) < SNAPSHOT_HEAP_DELTA && abs(rssi - snapshotRssi) < SNAPSHOT_RSSI_DELTA) return false;
+  snapshotDirty = false;
+  snapshotHeap = heap;
+  snapshotRssi = rssi;
+  char block[72], frag[64];
+  heapStatJson(block, sizeof(block), blockStat, 5);
+  heapStatJson(frag, sizeof(frag), fragStat, 4);
+  int n = snprintf(stateSnapshot, sizeof(stateSnapshot),
+    "{\"switch\":1,\"state\":\"%s\",\"mask\":%u,\"channels\":%u,\"heap\":%u,\"rssi\":%d,\"ap_disabled\":%s,\"tier\":%u,\"persist\":{\"pending\":%u,\"flushed\":%u},\"block\":%s,\"frag\":%s}",
+    (config.last_state & 1) ? "on" : "off", (unsigned)config.last_state, (unsigned)RELAY_CHANNELS, (unsigned)heap, (int)rssi, apDisabledByGuard ? "true" : "false", (unsigned)degradeTier,
+    (unsigned)(configWb.pending + relayWb.pending), (unsigned)(configWb.flushed + relayWb.flushed), block, frag);
+  stateSnapshotLen = (n > 0 && (size_t)n < sizeof(stateSnapshot)) ? n : 0;
+  if (stateSnapshotLen) server.broadcast("state", stateSnapshot, stateSnapshotLen);
+  return true;
+}
+// With subscribers, relay changes go out on the next pass and telemetry
+// drift within EVENTS_CHECK_INTERVAL (eventsTick); without, nothing is
+// rebuilt here.
+void pushEvents() {
+  if (snapshotDirty && server.subscribers()) refreshSnapshot();
+}
+void eventsTick() {
+  if (server.subscribers()) refreshSnapshot();
 }
 /* =======================
    Relay & MQTT Logic
    ======================= */
-void applyRelay(uint8_t state) {
-  digitalWrite(RELAY_PIN, state ? (RELAY_ACTIVE_LOW ? LOW : HIGH) : (RELAY_ACTIVE_LOW ? HIGH : LOW));
-  config.last_state = state;
-  saveConfig();
+/* All channels are driven by one store to each of the GPIO set/clear
+   registers, so a multi-channel command switches them together. */
+uint32_t relayPinBits = 0;
+void writeRelays(uint8_t mask) {
+  uint32_t on = 0;
+  for (uint8_t ch = 0; ch < RELAY_CHANNELS; ch++) {
+    if (mask & (1U << ch)) on |= 1UL << RELAY_PIN_LIST[ch];
+  }
+  uint32_t high = RELAY_ACTIVE_LOW ? (relayPinBits & ~on) : on;
+  GPOS = high;
+  GPOC = relayPinBits & ~high;
+}
+void applyRelay(uint8_t mask) {
+  mask &= RELAY_ALL;
+  writeRelays(mask);
+  if (mask == config.last_state) return;
+  config.last_state = mask;
+  markDirty(relayWb);
+}
+// PubSubClient's own limit: fixed header, topic length, topic and payload.
+bool mqttFits(const char* topic, size_t len) {
+  return 5 + 2 + strlen(topic) + len <= mqtt.getBufferSize();
+}
+/* While the session is down, the send buffer is full (AsyncMqttTransport
+   takes a packet whole or not at all), or older messages are still
+   waiting, a message is queued instead (replacing a queued one on the
+   same topic) and goes out in order once MQ_ONLINE drains the outbox.
+   One that the MQTT buffer cannot hold is dropped rather than queued,
+   where it would stall everything behind it. */
+bool publishOrQueue(const char* topic, const char* payload, size_t len, bool retained) {
+  if (mqtt.connected() && outbox.empty() && mqtt.publish(topic, (const uint8_t*)payload, len, retained)) return true;
+  if (mqttFits(topic, len)) outbox.put(topic, payload, len, retained);
+  return false;
 }
 void publishState() {
+  refreshSnapshot();
+  if (publishOrQueue(config.pub_topic, stateSnapshot, stateSnapshotLen, true)) statePublishes++;
+}
+bool publishQueued(const char* topic, const char* payload, size_t len, bool retained) {
+  if (!mqttFits(topic, len)) return true; // Buffer shrunk (heap guard) since it was queued: skip it
+  return mqtt.publish(topic, (const uint8_t*)payload, len, retained);
+}
+/* Command publishes go through the same write-behind as persistence: a
+   lone command publishes on the next pass, and a burst inside the window
+   collapses into one retained publish of the final state when it closes. */
+WriteBehind publishWb = {STATE_PUBLISH_WINDOW, 0, false, false, 0, 0, -1};
+void publishTick() {
+  if (!flushDue(publishWb)) return;
+  publishCoalesced += publishWb.pending - 1;
+  markFlushed(publishWb);
+  publishState();
+}
+/* Heartbeat reports: sent right after the state publish, so on the
+   default lwIP build (1072 B send buffer) they can meet a full buffer and
+   wait in the outbox. Not queued while offline, where they would push
+   state publishes out of it. */
+void publishPerf() {
   if (!mqtt.connected()) return;
-  JsonDocument doc; // Increased buffer
-  doc["switch"] = 1;
-  doc["state"] = config.last_state ? "on" : "off";
-  doc["heap"] = ESP.getFreeHeap();
-  doc["rssi"] = (WiFi.status() == WL_CONNECTED) ? WiFi.RSSI() : 0;
-
-  char payload[192];
-  serializeJson(doc, payload);
-  mqtt.publish(config.pub_topic, payload, true);
+  char topic[80], payload[PERF_JSON_SIZE];
+  snprintf(topic, sizeof(topic), "%s/perf", config.pub_topic);
+  size_t n = perfJson(payload, sizeof(payload));
+  publishOrQueue(topic, payload, n, false);
+  resetStageMax();
 }
-void mqttCallback(char* topic, byte* payload, unsigned int len) {
-  if (strcmp(topic, config.sub_topic) != 0) return;
+void publishBoot() {
+  char topic[80], payload[256];
+  snprintf(topic, sizeof(topic), "%s/boot", config.pub_topic);
+  int n = 0;
+  for (uint8_t i = 0; i < BOOT_COUNT && n >= 0 && (size_t)n < sizeof(payload); i++) {
+    if (bootMarks[i]) n += snprintf(payload + n, sizeof(payload) - n, "%c\"%s\":%u", n ? ',' : '{', BOOT_NAMES[i], (unsigned)bootMarks[i]);
+  }
+  if (n > 0 && (size_t)n < sizeof(payload)) n += snprintf(payload + n, sizeof(payload) - n, ",\"wifi_fast\":%s,\"topic_rejects\":%u}", wifiFast ? "true" : "false", topicRejects);
+  if (n > 0 && (size_t)n < sizeof(payload)) publishOrQueue(topic, payload, n, true);
+  bootReported = true;
+}
+// Once per broker session, after birth: how the last outage of each link went.
+void publishReconnect() {
+  char topic[80], payload[224];
+  snprintf(topic, sizeof(topic), "%s/reconnect", config.pub_topic);
+  const ReconnectPolicy* links[] = {&wifiPolicy, &mqttPolicy};
+  const char* const names[] = {"wifi", "mqtt"};
+  int n = 0;
+  for (uint8_t i = 0; i < 2 && n >= 0 && (size_t)n < sizeof(payload); i++) {
+    const ReconnectPolicy& p = *links[i];
+    n += snprintf(payload + n, sizeof(payload) - n, "%c\"%s\":{\"n\":%u,\"retries\":%u,\"last_retries\":%u,\"last_ms\":%u,\"max_ms\":%u}",
+                  i ? ',' : '{', names[i], (unsigned)p.connects(), (unsigned)p.retries(), (unsigned)p.lastRetries(), (unsigned)p.lastDownMs(), (unsigned)p.maxDownMs());
+  }
+  if (n > 0 && (size_t)n + 1 < sizeof(payload)) {
+    payload[n++] = '}';
+    publishOrQueue(topic, payload, n, false);
+  }
+}
+void publishTimers() {
+  if (!mqtt.connected()) return;
+  char topic[80], payload[TIMERS_JSON_SIZE];
+  snprintf(topic, sizeof(topic), "%s/timers", config.pub_topic);
+  size_t n = timersJson(payload, sizeof(payload));
+  publishOrQueue(topic, payload, n, false);
+  scheduler.resetMax();
+}
+// Rare shapes only (escapes, nested values); the hot path never allocates.
+bool parseCommandFallback(const byte* payload, unsigned int len, RelayCommand& cmd) {
   JsonDocument doc;
-  if (deserializeJson(doc, payload, len)) return;
+  if (deserializeJson(doc, payload, len)) return false;
+  cmd.action = CMD_NONE;
+  // Range-checked before the int16 store so 65537 cannot wrap to 1; 0 marks a bad channel
+  long channel = doc["channel"].is<long>() ? doc["channel"].as<long>() : 0;
+  cmd.channel = doc["channel"].isNull() ? -1 : (channel >= 1 && channel <= RELAY_CHANNELS ? channel : 0);
+  cmd.duration = doc["duration"].is<unsigned long>() ? doc["duration"].as<unsigned long>() : 0;
   if (doc["command"].is<const char*>()) {
-    const char* cmd = doc["command"];
-    if (!strcmp(cmd, "on")) applyRelay(1);
-    else if (!strcmp(cmd, "off")) applyRelay(0);
-    publishState();
+    const char* c = doc["command"];
+    cmd.action = commandAction(c, strlen(c));
   }
+  return true;
+}
+bool readCommand(const byte* payload, unsigned int len, RelayCommand& cmd) {
+  ParseResult res = parseCommand((const char*)payload, len, cmd);
+  if (res == PARSE_INVALID) return false;
+  if (res == PARSE_FALLBACK && !parseCommandFallback(payload, len, cmd)) return false;
+  return cmd.action != CMD_NONE;
+}
+void runCommand(CommandAction action, uint8_t channels) {
+  if (action == CMD_ON) applyRelay(config.last_state | channels);
+  else if (action == CMD_OFF) applyRelay(config.last_state & ~channels);
+  else if (action == CMD_TOGGLE) applyRelay(config.last_state ^ channels);
+}
+// Bit for a 1-based channel number; 0 when there is no such channel.
+uint8_t channelMask(int16_t channel) {
+  return (channel >= 1 && channel <= RELAY_CHANNELS) ? 1U << (channel - 1) : 0;
+}
+/* Topic handlers. `arg` is the route's channel; 0 on the main command topic,
+   where the payload's "channel" (1 when absent) picks it instead. */
+void onCommandTopic(uint8_t channel, byte* payload, unsigned int len) {
+  RelayCommand cmd;
+  if (!readCommand(payload, len, cmd)) return;
+  uint8_t mask = channelMask(channel ? channel : (cmd.channel < 0 ? 1 : cmd.channel));
+  if (!mask) return;
+  runCommand(cmd.action, mask);
+  markDirty(publishWb);
+}
+void onGroupTopic(uint8_t, byte* payload, unsigned int len) {
+  RelayCommand cmd;
+  if (!readCommand(payload, len, cmd)) return;
+  runCommand(cmd.action, RELAY_ALL);
+  markDirty(publishWb);
+}
+// Same keys as the /save form; applied after the session is rebuilt.
+bool mqttResubscribe = false;
+void onConfigTopic(uint8_t, byte* payload, unsigned int len) {
+  JsonDocument doc;
+  if (deserializeJson(doc, payload, len)) return;
+  bool changed = false, session = false;
+  for (const ConfigField& f : CONFIG_FIELDS) {
+    if (!doc[f.key].is<const char*>() || !setConfigField(f, doc[f.key].as<const char*>())) continue;
+    changed = true;
+    session |= f.session;
+  }
+  if (doc["port"].is<long>() && setConfigPort(doc["port"].as<long>())) changed = session = true;
+  bool addressing = false; // Used from the next association on
+  uint32_t ips[IP_FIELD_COUNT];
+  for (size_t i = 0; i < IP_FIELD_COUNT; i++) {
+    const IpField& f = IP_FIELDS[i];
+    ips[i] = configIp(f);
+    if (doc[f.key].is<const char*>()) addressing |= setConfigIp(f, doc[f.key].as<const char*>());
+  }
+  if (addressing && commitStaticIp(ips)) saveConfig();
+  bool power = false;
+  if (doc["power"].is<long>()) power |= setConfigPower(doc["power"].as<long>());
+  if (doc["max_lat"].is<long>()) power |= setConfigMaxLatency(doc["max_lat"].as<long>());
+  if (power) {
+    applyPowerMode();
+    saveConfig();
+  }
+  if (!changed) return;
+  saveConfig();
+  if (session) mqttResubscribe = true; // WiFi credentials and hostname wait for the next association or boot
+}
+TopicRouter topicRouter;
+char channelTopics[RELAY_CHANNELS][sizeof(Config::sub_topic) + 4];
+char configTopic[sizeof(Config::sub_topic) + 8];
+static_assert(RELAY_CHANNELS + 3 <= MAX_TOPIC_ROUTES, "registerTopics() needs a route per channel plus command, group and config");
+void registerTopics() {
+  topicRouter.clear();
+  topicRejects = 0;
+  topicRejects += !topicRouter.add(config.sub_topic, onCommandTopic, 0);
+  for (uint8_t ch = 1; ch <= RELAY_CHANNELS; ch++) {
+    snprintf(channelTopics[ch - 1], sizeof(channelTopics[0]), "%s/%u", config.sub_topic, ch);
+    topicRejects += !topicRouter.add(channelTopics[ch - 1], onCommandTopic, ch);
+  }
+  topicRejects += !topicRouter.add(GROUP_TOPIC, onGroupTopic);
+  snprintf(configTopic, sizeof(configTopic), "%s/config", config.sub_topic);
+  topicRejects += !topicRouter.add(configTopic, onConfigTopic);
+}
+void mqttCallback(char* topic, byte* payload, unsigned int len) {
+  topicRouter.dispatch(topic, payload, len);
+}
+/* Connects one step per loop pass: DNS -> TCP -> CONNECT/CONNACK ->
+   subscribe (each route) -> birth. DNS and TCP never block, so an
+   unreachable broker costs nothing. CONNECT/CONNACK still runs inside
+   mqtt.connect(), which waits up to MQTT_CONNACK_TIMEOUT for the answer:
+   one round trip normally, the full window against a broker that accepts
+   TCP and then stalls. Each attempt starts from the mqttTask timer,
+   re-armed by mqttPolicy after a failure or a dropped session. */
+enum MqttPhase : uint8_t { MQ_IDLE, MQ_RESOLVE, MQ_TCP, MQ_SESSION, MQ_SUBSCRIBE, MQ_BIRTH, MQ_ONLINE };
+MqttPhase mqttPhase = MQ_IDLE;
+unsigned long mqttPhaseStart = 0;
+uint8_t mqttSubscribed = 0; // Routes subscribed this session
+int8_t mqttTask = -1;
+IPAddress brokerIp;
+volatile bool brokerResolved = false, brokerDnsFailed = false;
+void mqttEnter(MqttPhase phase) {
+  mqttPhase = phase;
+  mqttPhaseStart = millis();
+}
+void mqttClose() {
+  mqtt.disconnect();
+  mqttTransport.stop();
+  mqttEnter(MQ_IDLE);
+}
+void mqttAbort() {
+  mqttClose();
+  mqttPolicy.down();
+  scheduler.wake(mqttTask, mqttPolicy.next());
+}
+void onBrokerResolved(const char*, const ip_addr_t* addr, void*) {
+  if (addr) {
+    brokerIp = IPAddress(ip_addr_get_ip4_u32(addr));
+    brokerResolved = true;
+  } else {
+    brokerDnsFailed = true;
+  }
+}
+void mqttStart() {
+  if (mqttPhase != MQ_IDLE || WiFi.status() != WL_CONNECTED) return; // MQ_IDLE re-arms once the station is back
+  if (mqttResubscribe) {
+    mqttResubscribe = false;
+    registerTopics();
+  }
+  brokerResolved = brokerDnsFailed = false;
+  mqttEnter(MQ_RESOLVE);
+  if (brokerIp.fromString(config.mqtt_broker)) {
+    brokerResolved = true;
+    return;
+  }
+  ip_addr_t addr;
+  err_t err = dns_gethostbyname(config.mqtt_broker, &addr, onBrokerResolved, nullptr);
+  if (err == ERR_OK) onBrokerResolved(config.mqtt_broker, &addr, nullptr);
+  else if (err != ERR_INPROGRESS) mqttAbort();
 }
 void ensureMqtt() {
-  if (WiFi.status() != WL_CONNECTED || strlen(config.mqtt_broker) < 3) return;
-  if (mqtt.connected()) return;
-  if (millis() - lastMqttAttempt < MQTT_RECONNECT_DELAY) return;
-
-  lastMqttAttempt = millis();
-  mqtt.setServer(config.mqtt_broker, config.mqtt_port);
-  mqtt.setCallback(mqttCallback);
+  if (mqttPhase != MQ_IDLE && WiFi.status() != WL_CONNECTED) return mqttAbort();
+  if (mqttPhase != MQ_IDLE && mqttPhase != MQ_ONLINE && millis() - mqttPhaseStart > MQTT_PHASE_TIMEOUT) return mqttAbort();
 
-  char clientId[32];
-  snprintf(clientId, sizeof(clientId), "BedTimeESP-%06X", ESP.getChipId());
-
-  // Birth & LWT Logic (QoS 1, Retained)
-  if (mqtt.connect(clientId, config.mqtt_user, config.mqtt_pass, config.avail_topic, 1, true, "offline")) {
-    // Note: Birth is QoS 0 (PubSubClient limitation); LWT is QoS 1 via broker.
-    mqtt.publish(config.avail_topic, "online", true); // Birth Message
-    mqtt.subscribe(config.sub_topic);
-    publishState();
+  switch (mqttPhase) {
+    case MQ_IDLE: // A retry already armed keeps its delay
+      if (WiFi.status() == WL_CONNECTED && strlen(config.mqtt_broker) >= 3 && !scheduler.pending(mqttTask)) scheduler.wake(mqttTask, 0);
+      return;
+    case MQ_RESOLVE:
+      if (brokerDnsFailed) mqttAbort();
+      else if (brokerResolved) {
+        if (mqttTransport.begin(brokerIp, config.mqtt_port)) mqttEnter(MQ_TCP);
+        else mqttAbort();
+      }
+      return;
+    case MQ_TCP:
+      if (mqttTransport.connected()) mqttEnter(MQ_SESSION);
+      else if (mqttTransport.failed()) mqttAbort();
+      return;
+    case MQ_SESSION: {
+      char clientId[32];
+      snprintf(clientId, sizeof(clientId), "BedTimeESP-%06X", ESP.getChipId());
+      // Birth & LWT Logic (QoS 1, Retained). The socket is already open;
+      // this blocks until CONNACK or MQTT_CONNACK_TIMEOUT.
+      if (mqtt.connect(clientId, config.mqtt_user, config.mqtt_pass, config.avail_topic, 1, true, "offline")) {
+        bootMark(BOOT_CONNACK);
+        mqttSubscribed = 0;
+        mqttEnter(MQ_SUBSCRIBE);
+      } else {
+        mqttAbort();
+      }
+      return;
+    }
+    case MQ_SUBSCRIBE: // One route per pass
+      if (mqttSubscribed < topicRouter.size() && !mqtt.subscribe(topicRouter.topic(mqttSubscribed++))) return mqttAbort();
+      if (mqttSubscribed >= topicRouter.size()) mqttEnter(MQ_BIRTH);
+      return;
+    case MQ_BIRTH:
+      // Note: Birth is QoS 0 (PubSubClient limitation); LWT is QoS 1 via broker.
+      mqtt.publish(config.avail_topic, "online", true); // Birth Message
+      publishState();
+      bootMark(BOOT_PUBLISH);
+      if (!bootReported) publishBoot();
+      mqttPolicy.up();
+      publishReconnect();
+      mqttEnter(MQ_ONLINE);
+      return;
+    case MQ_ONLINE:
+      if (mqttResubscribe) {
+        mqttClose(); // Clean session drops the old subscriptions
+        scheduler.wake(mqttTask, 0);
+      } else if (!mqtt.connected()) {
+        mqttAbort(); // Broker gone: every device saw it at once, so wait a jittered delay
+      } else {
+        outbox.drain(publishQueued, 1); // Held messages, one per pass
+      }
+      return;
   }
 }
+/* Last good association: channel and BSSID let begin() skip the scan,
+   and after a reset the IP lease applied with WiFi.config() skips DHCP. Kept in RTC
+   memory, which survives a reset, and as a record of the config image
+   for power cycles. Bound to the SSID, so new credentials ignore it. The
+   first attempt of an outage uses it; if that does not associate within
+   WIFI_FAST_TIMEOUT the retries scan and ask DHCP again. */
+bool wifiFastTried = false; // This outage: the cached join was used up, scan instead
+bool wifiLeaseFresh = false; // Lease from this power-on (RAM or RTC copy); the EEPROM one may have expired
+uint32_t wifiCacheCheck(const WifiCache& c) {
+  uint32_t h = 2166136261UL;
+  for (const char* p = config.ssid; *p; p++) h = (h ^ (uint8_t)*p) * 16777619UL;
+  const uint8_t* b = (const uint8_t*)&c + sizeof(c.check);
+  for (size_t i = sizeof(c.check); i < sizeof(c); i++) h = (h ^ *b++) * 16777619UL;
+  return h;
+}
+// After loadConfig(), which left the EEPROM copy in wifiCache.
+void loadWifiCache() {
+  WifiCache rtc;
+  ESP.rtcUserMemoryRead(WIFI_CACHE_RTC, (uint32_t*)&rtc, sizeof(rtc));
+  if (rtc.check == wifiCacheCheck(rtc)) {
+    wifiCache = rtc;
+    wifiLeaseFresh = true;
+  }
+  wifiCacheValid = wifiCache.channel && wifiCache.check == wifiCacheCheck(wifiCache);
+}
+void saveWifiCache() {
+  WifiCache c = {};
+  memcpy(c.bssid, WiFi.BSSID(), sizeof(c.bssid));
+  c.channel = WiFi.channel();
+  c.ip = WiFi.localIP();
+  c.gateway = WiFi.gatewayIP();
+  c.mask = WiFi.subnetMask();
+  c.dns = WiFi.dnsIP();
+  c.check = wifiCacheCheck(c);
+  bool changed = !wifiCacheValid || memcmp(&c, &wifiCache, sizeof(c));
+  if (!changed && wifiLeaseFresh) return; // RTC already holds it
+  wifiCache = c;
+  wifiCacheValid = true;
+  wifiLeaseFresh = true;
+  ESP.rtcUserMemoryWrite(WIFI_CACHE_RTC, (uint32_t*)&wifiCache, sizeof(wifiCache));
+  if (changed) markDirty(configWb); // Rides on the next config flush
+}
+/* The station link is checked every pass (one SDK call); attempts run
+   from wifiTask, re-armed by wifiPolicy until the station is up. */
+int8_t wifiTask = -1;
+// A configured static address wins over the cached lease; without
+// either the station asks DHCP. The lease is only reused within the
+// power-on that got it: after a power cycle it may have expired or
+// been handed to another host, and an IP conflict does not stop the
+// join, so nothing would fall back to DHCP.
+void wifiAttempt() {
+  wifiFast = wifiCacheValid && !wifiFastTried;
+  wifiFastTried = true;
+  if (config.ip_addr) WiFi.config(config.ip_addr, config.ip_gateway, config.ip_mask, config.ip_dns ? config.ip_dns : config.ip_gateway);
+  else if (wifiFast && wifiLeaseFresh && WIFI_REUSE_LEASE) WiFi.config(wifiCache.ip, wifiCache.gateway, wifiCache.mask, wifiCache.dns);
+  else WiFi.config(IPAddress(), IPAddress(), IPAddress());
+  if (wifiFast) {
+    WiFi.begin(config.ssid, config.pass, wifiCache.channel, wifiCache.bssid);
+    scheduler.wake(wifiTask, WIFI_FAST_TIMEOUT);
+    return;
+  }
+  WiFi.begin(config.ssid, config.pass);
+  scheduler.wake(wifiTask, wifiPolicy.next());
+}
 void ensureWifi() {
   if (WiFi.status() == WL_CONNECTED) return;
   if (strlen(config.ssid) < 1) return; // Prevent spam on empty config
-  if (millis() - lastWifiAttempt < WIFI_RECONNECT_DELAY) return;
-  lastWifiAttempt = millis();
-  WiFi.begin(config.ssid, config.pass);
+  wifiAttempt();
+}
+void trackWifi() {
+  bool up = WiFi.status() == WL_CONNECTED;
+  if (up == wifiPolicy.isUp()) return;
+  if (up) {
+    bootMark(BOOT_IP);
+    wifiPolicy.up();
+    scheduler.cancel(wifiTask);
+    saveWifiCache();
+  } else {
+    wifiPolicy.down();
+    wifiFastTried = false; // New outage: its first attempt joins directly again
+    scheduler.wake(wifiTask, wifiPolicy.next());
+  }
 }
 /* =======================
    Stability & Web UI
    ======================= */
+/* Degradation tiers, shed in this order as the heap tightens and restored
+   in reverse, one step per sample. Each tier has its own enter/exit pair
+   on the largest free block and fragmentation (a fragmented heap can have
+   plenty free and still fail a TCP buffer), so a heap hovering at one
+   threshold does not flap. Every tier below degradeTier is shed too. */
+enum DegradeTier : uint8_t { TIER_NONE, TIER_MDNS, TIER_MQTT_BUFFER, TIER_HTTP, TIER_AP, TIER_COUNT };
+struct DegradeStep {
+  const char* name;
+  uint32_t enterBlock, exitBlock; // Largest free block (bytes)
+  uint8_t enterFrag, exitFrag;    // ESP.getHeapFragmentation() (%)
+};
+const DegradeStep DEGRADE_STEPS[TIER_COUNT] = {
+  {"none", 0, 0, 0, 0},
+  {"mdns", 8192, 12288, 35, 25},
+  {"mqtt_buffer", 6144, 10240, 40, 30},
+  {"http", 5120, 9216, 45, 35},
+  {"ap", 4096, 8192, 50, 30},
+};
+uint16_t degradeEntries[TIER_COUNT]; // Times each tier was entered
+uint32_t degradeTransitions = 0;
+// Shedding always counts: a lever that fails or is already off is off, and
+// the guard must still reach the tiers above it. Restoring can fail, which
+// keeps the tier until the next sample.
+bool shedTier(uint8_t tier, bool shed) {
+  switch (tier) {
+    case TIER_MDNS:
+      if (shed) {
+        if (mdnsUp) MDNS.end();
+        mdnsUp = false;
+        return true;
+      }
+      if (!mdnsStarted) return true;
+      mdnsUp = MDNS.begin(config.hostname);
+      return mdnsUp;
+    case TIER_MQTT_BUFFER: return mqtt.setBufferSize(shed ? MQTT_BUFFER_LOW : MQTT_BUFFER_SIZE) || shed; // Growing can fail
+    case TIER_HTTP: server.setAccepting(!shed); return true;
+    case TIER_AP: return true; // updateAp() follows degradeTier
+  }
+  return false;
+}
+// Retained on <pub_t>/degrade; queued with the rest while offline.
+void enterTier(uint8_t tier, uint32_t block, uint8_t frag) {
+  uint8_t from = degradeTier;
+  degradeTier = tier;
+  degradeTransitions++;
+  if (tier > from) degradeEntries[tier]++;
+  apDisabledByGuard = tier >= TIER_AP;
+  updateAp();
+  snapshotDirty = true;
+  char topic[80], payload[160];
+  snprintf(topic, sizeof(topic), "%s/degrade", config.pub_topic);
+  int n = snprintf(payload, sizeof(payload), "{\"tier\":%u,\"name\":\"%s\",\"from\":%u,\"block\":%u,\"frag\":%u,\"transitions\":%u,\"entries\":[%u,%u,%u,%u]}",
+                   tier, DEGRADE_STEPS[tier].name, from, (unsigned)block, frag, (unsigned)degradeTransitions,
+                   degradeEntries[TIER_MDNS], degradeEntries[TIER_MQTT_BUFFER], degradeEntries[TIER_HTTP], degradeEntries[TIER_AP]);
+  if (n > 0 && (size_t)n < sizeof(payload)) publishOrQueue(topic, payload, n, true);
+}
+// Every HEAP_SAMPLE_INTERVAL.
 void heapGuard() {
-  uint32_t freeHeap = ESP.getFreeHeap();
-  if (!apDisabledByGuard && freeHeap < MIN_SAFE_HEAP) {
-    WiFi.softAPdisconnect(true);
-    apDisabledByGuard = true;
-  } else if (apDisabledByGuard && freeHeap > SAFE_HEAP_RECOVER) {
-    WiFi.softAP(config.hostname);
-    apDisabledByGuard = false;
-  }
-}
-void handleSave() {
-  auto updateField = [](char* dest, const char* argName, size_t size) {
-    if (server.hasArg(argName)) {
-      strncpy(dest, server.arg(argName).c_str(), size);
-      dest[size - 1] = '\0';
+  uint32_t block = ESP.getMaxFreeBlockSize();
+  uint8_t frag = ESP.getHeapFragmentation();
+  recordHeapStat(blockStat, block, BLOCK_EDGES, 4);
+  recordHeapStat(fragStat, frag, FRAG_EDGES, 3);
+  if (degradeTier + 1 < TIER_COUNT) {
+    const DegradeStep& next = DEGRADE_STEPS[degradeTier + 1];
+    if (block < next.enterBlock || frag > next.enterFrag) {
+      shedTier(degradeTier + 1, true);
+      return enterTier(degradeTier + 1, block, frag);
     }
-  };
-  updateField(config.ssid, "ssid", sizeof(config.ssid));
-  updateField(config.pass, "pass", sizeof(config.pass));
-  updateField(config.hostname, "host", sizeof(config.hostname));
-  updateField(config.mqtt_broker, "broker", sizeof(config.mqtt_broker));
-  updateField(config.mqtt_user, "m_user", sizeof(config.mqtt_user));
-  updateField(config.mqtt_pass, "m_pass", sizeof(config.mqtt_pass));
-  updateField(config.pub_topic, "pub_t", sizeof(config.pub_topic));
-  updateField(config.sub_topic, "sub_t", sizeof(config.sub_topic));
-  updateField(config.avail_topic, "avail_t", sizeof(config.avail_topic));
-
-  if (server.hasArg("port")) {
-    long p = server.arg("port").toInt();
-    if (p >= 1 && p <= 65535) config.mqtt_port = (uint16_t)p;
   }
+  const DegradeStep& cur = DEGRADE_STEPS[degradeTier];
+  if (degradeTier && block > cur.exitBlock && frag < cur.exitFrag && shedTier(degradeTier, false)) enterTier(degradeTier - 1, block, frag);
+}
+void handleSave(AsyncHttpRequest& req) {
+  char value[sizeof(Config::pass)];
+  // Addressing first, so a rejected form leaves the config untouched.
+  uint32_t ips[IP_FIELD_COUNT];
+  for (size_t i = 0; i < IP_FIELD_COUNT; i++) {
+    ips[i] = configIp(IP_FIELDS[i]);
+    if (req.arg(IP_FIELDS[i].key, value, sizeof(value))) setConfigIp(IP_FIELDS[i], value);
+  }
+  if (!commitStaticIp(ips)) {
+    req.send(400, "text/plain", "Static IP needs a gateway and a subnet mask");
+    return;
+  }
+  for (const ConfigField& f : CONFIG_FIELDS) {
+    if (req.arg(f.key, value, sizeof(value))) setConfigField(f, value);
+  }
+  if (req.arg("port", value, sizeof(value))) setConfigPort(atol(value));
+  if (req.arg("power", value, sizeof(value))) setConfigPower(atol(value));
+  if (req.arg("max_lat", value, sizeof(value))) setConfigMaxLatency(atol(value));
   saveConfig();
-  server.send(200, "text/plain", "Saved. Rebooting...");
+  persistTick(true); // Rebooting: flush now
+  req.send(200, "text/plain", "Saved. Rebooting...");
   delay(1200);
   ESP.restart();
 }
-void handleRoot() {
-  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
-  server.send(200, "text/html", "");
-  server.sendContent_P(PSTR("<!DOCTYPE html><html><head><meta name='viewport' content='width=device-width, initial-scale=1'><title>BedTimeESP</title><style>body{font-family:sans-serif;padding:10px;background:#f4f4f4;} .card{background:white;padding:20px;border-radius:10px;max-width:400px;margin:auto;} input{width:100%;padding:8px;margin:5px 0;box-sizing:border-box;} button{width:100%;padding:10px;background:#2ecc71;color:white;border:none;border-radius:5px;margin-top:10px;}</style></head><body><div class='card'><h2>BedTimeESP Config</h2><form method='POST' action='/save'>"));
-
-  auto sendInput = [](const char* label, const char* name, const char* val, const char* type="text") {
-    server.sendContent(String(label) + ":<br><input name='" + String(name) + "' type='" + String(type) + "' value='" + String(val) + "'><br>");
-  };
-  sendInput("WiFi SSID", "ssid", config.ssid);
-  sendInput("WiFi Pass", "pass", config.pass, "password");
-  sendInput("Hostname", "host", config.hostname);
-  sendInput("MQTT Broker", "broker", config.mqtt_broker);
-  sendInput("MQTT Port", "port", String(config.mqtt_port).c_str(), "number");
-  sendInput("MQTT User", "m_user", config.mqtt_user);
-  sendInput("MQTT Pass", "m_pass", config.mqtt_pass, "password");
-  sendInput("State Topic", "pub_t", config.pub_topic);
-  sendInput("Command Topic", "sub_t", config.sub_topic);
-  sendInput("Availability Topic", "avail_t", config.avail_topic);
-  server.sendContent_P(PSTR("<button type='submit'>Save & Reboot</button></form></div></body></html>"));
-  server.sendContent("");
+// Static UI, gzipped at build time (tools/embed_web.py). Browsers revalidate
+// with If-None-Match and get a bodyless 304 until the firmware changes.
+#define WEB_INDEX_HEADERS "ETag: " WEB_INDEX_ETAG "\r\nCache-Control: no-cache\r\n"
+void handleRoot(AsyncHttpRequest& req) {
+  if (!strcmp(req.ifNoneMatch(), WEB_INDEX_ETAG)) {
+    req.send(304, nullptr, "", 0, WEB_INDEX_HEADERS);
+    return;
+  }
+  req.send_P(200, "text/html", (PGM_P)WEB_INDEX_GZ, sizeof(WEB_INDEX_GZ), WEB_INDEX_HEADERS "Content-Encoding: gzip\r\n");
+}
+// ChunkWriter sink: one unchunked send when the body fits the buffer.
+AsyncHttpRequest* chunkReq = nullptr;
+const char* chunkType = "text/plain";
+void sendChunk(const char* data, size_t len, bool first, bool last) {
+  if (first) chunkReq->beginResponse(200, chunkType, last ? len : HTTP_CHUNKED, "Cache-Control: no-store\r\n");
+  chunkReq->write(data, len);
+  if (last) chunkReq->end();
+}
+void handleConfigJson(AsyncHttpRequest& req) {
+  char buf[CHUNK_BUFFER_SIZE];
+  ChunkWriter out(buf, sizeof(buf), sendChunk);
+  chunkReq = &req;
+  chunkType = "application/json";
+  char sep = '{';
+  for (const ConfigField& f : CONFIG_FIELDS) {
+    out.write(&sep, 1).jsonString(f.key).print(":").jsonString((const char*)&config + f.offset);
+    sep = ',';
+  }
+  out.print(",\"port\":").print(config.mqtt_port);
+  for (const IpField& f : IP_FIELDS) {
+    char ip[16];
+    formatIp(*(const uint32_t*)((const char*)&config + f.offset), ip, sizeof(ip));
+    out.print(",").jsonString(f.key).print(":").jsonString(ip);
+  }
+  out.print(",\"power\":").print(config.power_mode).print(",\"max_lat\":").print(config.max_latency).print("}");
+  out.finish();
+}
+// Live state for the UI: the current snapshot at once, then every rebuild.
+void handleEvents(AsyncHttpRequest& req) {
+  if (!server.subscribe(req)) {
+    req.send(503, "text/plain", "Too many subscribers");
+    return;
+  }
+  if (!refreshSnapshot()) req.event("state", stateSnapshot, stateSnapshotLen); // A rebuild already broadcast it
+}
+/* REST control. GET returns the state snapshot; POST takes the MQTT command
+   JSON, or command=/channel= form or query fields, and answers with the
+   updated snapshot so one round trip switches and confirms. Keep-alive
+   clients skip the TCP handshake on every call after the first. */
+void handleRelayApi(AsyncHttpRequest& req) {
+  if (req.method() == HTTP_POST) {
+    RelayCommand cmd = {CMD_NONE, -1, 0};
+    if (!req.bodyLength() || !readCommand((const byte*)req.body(), req.bodyLength(), cmd)) {
+      char value[12];
+      if (req.arg("command", value, sizeof(value))) cmd.action = commandAction(value, strlen(value));
+      if (req.arg("channel", value, sizeof(value))) {
+        char* end;
+        long channel = strtol(value, &end, 10);
+        cmd.channel = (*value && !*end && channel >= 1 && channel <= RELAY_CHANNELS) ? channel : 0;
+      }
+    }
+    uint8_t mask = channelMask(cmd.channel < 0 ? 1 : cmd.channel); // Default only when absent
+    if (cmd.action < CMD_ON || !mask) {
+      req.send(400, "application/json", "{\"error\":\"bad command or channel\"}");
+      return;
+    }
+    runCommand(cmd.action, mask);
+    markDirty(publishWb);
+  } else if (req.method() != HTTP_GET) {
+    req.send(405, "application/json", "{\"error\":\"use GET or POST\"}");
+    return;
+  }
+  refreshSnapshot();
+  req.send(200, "application/json", stateSnapshot, stateSnapshotLen, "Cache-Control: no-store\r\n");
+}
+void heartbeat() {
+  snapshotDirty = true; // Carry this window's heap stats
+  publishState();
+  publishPerf();
+  publishTimers();
+  resetHeapStats();
+}
+// Checked against the server's fixed route table at compile time, so a
+// new route cannot fall through to 404.
+struct HttpRoute {
+  const char* path;
+  HttpMethod method;
+  HttpHandler fn;
+};
+const HttpRoute HTTP_ROUTES[] = {
+  {"/", HTTP_GET, handleRoot},
+  {"/config.json", HTTP_GET, handleConfigJson},
+  {"/save", HTTP_POST, handleSave},
+  {"/status", HTTP_GET, [](AsyncHttpRequest& req){
+      refreshSnapshot();
+      req.send(200, "application/json", stateSnapshot, stateSnapshotLen);
+  }},
+  {"/api/relay", HTTP_ANY, handleRelayApi},
+  {"/events", HTTP_GET, handleEvents},
+  {"/perf", HTTP_GET, [](AsyncHttpRequest& req){
+      char out[PERF_JSON_SIZE]; perfJson(out, sizeof(out)); req.send(200, "application/json", out);
+  }},
+  {"/timers", HTTP_GET, [](AsyncHttpRequest& req){
+      char out[TIMERS_JSON_SIZE]; timersJson(out, sizeof(out)); req.send(200, "application/json", out);
+  }},
+};
+static_assert(sizeof(HTTP_ROUTES) / sizeof(HTTP_ROUTES[0]) <= HTTP_MAX_ROUTES, "raise HTTP_MAX_ROUTES");
+// Every scheduler task, checked against its fixed table at compile time:
+// nothing checks the ids at run time, so a task past SCHED_MAX_TASKS
+// would get -1 and never run. Period 0 is a one-shot, idle until woken.
+struct TimerSpec {
+  const char* name;
+  Scheduler::TaskFn fn;
+  uint32_t period, first;
+  int8_t* id;
+};
+const TimerSpec TIMERS[] = {
+  {"journal", []{ persistTick(); }, 0, 0, &relayWb.task},
+  {"eeprom", []{ persistTick(); }, 0, 0, &configWb.task},
+  {"publish", publishTick, 0, 0, &publishWb.task},
+  {"mqtt", mqttStart, 0, 0, &mqttTask},
+  {"wifi", ensureWifi, 0, 0, &wifiTask},
+  {"ap", updateAp, 0, 0, &apTask},
+  {"heap", heapGuard, HEAP_SAMPLE_INTERVAL, 0, nullptr},
+  {"events", eventsTick, EVENTS_CHECK_INTERVAL, EVENTS_CHECK_INTERVAL, nullptr},
+  {"heartbeat", heartbeat, HEARTBEAT_INTERVAL, HEARTBEAT_INTERVAL, nullptr},
+};
+static_assert(sizeof(TIMERS) / sizeof(TIMERS[0]) <= SCHED_MAX_TASKS, "raise SCHED_MAX_TASKS");
+// Before anything can markDirty(): the write-behinds need their timers.
+void startTimers() {
+  for (const TimerSpec& t : TIMERS) {
+    int8_t id = t.period ? scheduler.every(t.name, t.fn, t.period, t.first) : scheduler.once(t.name, t.fn);
+    if (t.id) *t.id = id;
+  }
 }
 void setup() {
-  pinMode(RELAY_PIN, OUTPUT);
-  digitalWrite(RELAY_PIN, RELAY_ACTIVE_LOW ? HIGH : LOW);
+  bootMark(BOOT_SETUP);
+  startTimers();
+  for (uint8_t pin : RELAY_PIN_LIST) relayPinBits |= 1UL << pin;
+  writeRelays(0);
+  for (uint8_t pin : RELAY_PIN_LIST) pinMode(pin, OUTPUT);
+  bootMark(BOOT_GPIO);
   EEPROM.begin(EEPROM_SIZE);
+  bootMark(BOOT_EEPROM);
   loadConfig();
-  applyRelay(config.last_state);
+  EEPROM.end(); // Frees the sector copy; writeConfig() maps only what it writes
+  loadWifiCache();
+  bootMark(BOOT_CONFIG);
+  uint8_t mask = config.last_state;
+  if (relayJournal.begin()) relayJournal.read(mask);
+  applyRelay(mask);
+  bootMark(BOOT_RELAY);
   WiFi.mode(WIFI_AP_STA);
   WiFi.softAP(config.hostname);
-  WiFi.begin(config.ssid, config.pass);
-  MDNS.begin(config.hostname);
-  server.on("/", handleRoot);
-  server.on("/save", HTTP_POST, handleSave);
-  server.on("/status", [](){
-      JsonDocument doc;
-      doc["state"] = config.last_state ? "on" : "off";
-      doc["heap"] = ESP.getFreeHeap();
-      doc["ap_disabled"] = apDisabledByGuard;
-      char out[128]; serializeJson(doc, out); server.send(200, "application/json", out);
-  });
+  bootMark(BOOT_AP);
+  wifiAttempt();
+  applyPowerMode();
+  mdnsStarted = mdnsUp = MDNS.begin(config.hostname);
+  bootMark(BOOT_MDNS);
+  for (const HttpRoute& r : HTTP_ROUTES) server.on(r.path, r.method, r.fn);
   server.begin();
+  mqtt.setBufferSize(MQTT_BUFFER_SIZE);
+  mqtt.setSocketTimeout(MQTT_CONNACK_TIMEOUT);
+  registerTopics();
+  mqtt.setCallback(mqttCallback);
 }
 void loop() {
-  server.handleClient();
-  MDNS.update();
-  ensureWifi();
-  ensureMqtt();
-  mqtt.loop();
-  heapGuard();
-  if (millis() - lastHeartbeat > HEARTBEAT_INTERVAL) {
-    lastHeartbeat = millis();
-    publishState();
-  }
+  uint32_t loopStart = ESP.getCycleCount();
+  bootMark(BOOT_LOOP);
+  PERF_STAGE(STAGE_HTTP, server.poll(); pushEvents());
+  PERF_STAGE(STAGE_MDNS, if (mdnsUp) MDNS.update());
+  PERF_STAGE(STAGE_MQTT_CONN, trackWifi(); ensureMqtt());
+  PERF_STAGE(STAGE_MQTT_LOOP, mqtt.loop());
+  PERF_STAGE(STAGE_TIMERS, scheduler.run());
+  recordStage(STAGE_LOOP, ESP.getCycleCount() - loopStart);
+  powerIdle();
 }
\ No newline at end of file
@@ -0,0 +1,51 @@
+"""Gzip web/index.html into include/web_index.h for serving from PROGMEM.
+
+Runs as a PlatformIO pre-build script (extra_scripts = pre:tools/embed_web.py)
+or standalone: python3 tools/embed_web.py
+"""
+import gzip
+import hashlib
+import os
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO/SCons
+    ROOT = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+SRC = os.path.join(ROOT, "web", "index.html")
+OUT = os.path.join(ROOT, "include", "web_index.h")
+
+
+def render(gz, etag):
+    lines = [
+        "// Generated by tools/embed_web.py from web/index.html - do not edit.",
+        "#pragma once",
+        "#include <Arduino.h>",
+        "",
+        '#define WEB_INDEX_ETAG "\\"%s\\""' % etag,
+        "",
+        "const uint8_t WEB_INDEX_GZ[] PROGMEM = {",
+    ]
+    for i in range(0, len(gz), 16):
+        lines.append("  " + ",".join("0x%02x" % b for b in gz[i:i + 16]) + ",")
+    lines.append("};")
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    with open(SRC, "rb") as f:
+        html = f.read()
+    gz = gzip.compress(html, compresslevel=9, mtime=0)  # mtime=0: same input, same bytes
+    etag = hashlib.sha1(gz).hexdigest()[:16]
+    text = render(gz, etag)
+    if os.path.exists(OUT):
+        with open(OUT) as f:
+            if f.read() == text:
+                return  # Leave the timestamp alone so nothing rebuilds
+    with open(OUT, "w") as f:
+        f.write(text)
+    print("embed_web: %d -> %d bytes gzip, etag %s" % (len(html), len(gz), etag))
+
+
+main()